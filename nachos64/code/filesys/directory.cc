@@ -1,20 +1,20 @@
 // directory.cc 
 //	Routines to manage a directory of file names.
 //
-//	The directory is a table of fixed length entries; each
-//	entry represents a single file, and contains the file name,
-//	and the location of the file header on disk.  The fixed size
-//	of each directory entry means that we have the restriction
-//	of a fixed maximum size for file names.
+//	The directory is a B+-tree of fixed length entries, sorted by
+//	name; each entry represents a single file, and contains the
+//	file name, and the location of the file header on disk.  The
+//	fixed size of each directory entry means that we have the
+//	restriction of a fixed maximum size for file names.
 //
-//	The constructor initializes an empty directory of a certain size;
-//	we use ReadFrom/WriteBack to fetch the contents of the directory
-//	from disk, and to write back any modifications back to disk.
+//	Each node of the tree is NodeSize bytes of the directory file
+//	(a sector, unless the disk has bigger sectors), so an operation
+//	on the directory only reads and writes the sectors it needs.
+//	When a node is full, it is split in two, and the new node is
+//	added at the end of the file, which grows as needed.
 //
-//	Also, this implementation has the restriction that the size
-//	of the directory cannot expand.  In other words, once all the
-//	entries in the directory are used, no more files can be created.
-//	Fixing this is one of the parts to the assignment.
+//	Directories in the older format -- a fixed size table of
+//	entries -- are kept in memory, with a hash index on the names.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -25,22 +25,57 @@
 #include "filehdr.h"
 #include "directory.h"
 
+//----------------------------------------------------------------------
+// CompareNames
+// 	Compare two file names, as strcmp does; only the first
+//	FileNameMaxLen characters count.
+//----------------------------------------------------------------------
+
+static int
+CompareNames(const char *a, const char *b)
+{
+    return strncmp(a, b, FileNameMaxLen);
+}
+
 //----------------------------------------------------------------------
 // Directory::Directory
-// 	Initialize a directory; initially, the directory is completely
-//	empty.  If the disk is being formatted, an empty directory
-//	is all we need, but otherwise, we need to call FetchFrom in order
-//	to initialize it from disk.
+// 	Get ready to work on the directory stored in "dirFile".  For a
+//	directory in the B+-tree format, only the header is read; a
+//	legacy table is read in full.
 //
-//	"size" is the number of entries in the directory
+//	If the file does not hold a directory yet, Initialize must be
+//	called before anything else.
+//
+//	"dirFile" is the open directory file; it must stay open as long
+//		as the Directory is in use
 //----------------------------------------------------------------------
 
-Directory::Directory(int size)
+Directory::Directory(OpenFile *dirFile)
 {
-    table = new DirectoryEntry[size];
-    tableSize = size;
+    int b;
+
+    file = dirFile;
+    table = NULL;
+    bucket = hashNext = NULL;
+    file->ReadAt((char *) &header, sizeof(DirectoryHeader), 0);
+    legacy = (header.magic != DirectoryMagic && file->Length() > 0);
+    if (!legacy)
+	return;
+
+    tableSize = file->Length() / sizeof(DirectoryEntry);
+    table = new DirectoryEntry[tableSize];
+    file->ReadAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    numBuckets = tableSize;
+    bucket = new int[numBuckets];
+    hashNext = new int[tableSize];
+    for (int i = 0; i < numBuckets; i++)
+	bucket[i] = -1;
     for (int i = 0; i < tableSize; i++)
-	table[i].inUse = false;
+	if (table[i].inUse) {
+	    b = Hash(table[i].name);
+	    hashNext[i] = bucket[b];
+	    bucket[b] = i;
+	}
 }
 
 //----------------------------------------------------------------------
@@ -51,49 +86,89 @@ Directory::Directory(int size)
 Directory::~Directory()
 { 
     delete [] table;
+    delete [] bucket;
+    delete [] hashNext;
 } 
 
 //----------------------------------------------------------------------
-// Directory::FetchFrom
-// 	Read the contents of the directory from disk.
-//
-//	"file" -- file containing the directory contents
+// Directory::Initialize
+// 	Write an empty directory into the directory file: a header, and
+//	a root that is an empty leaf.  The file must be at least
+//	EmptyDirectorySize bytes long.
 //----------------------------------------------------------------------
 
 void
-Directory::FetchFrom(OpenFile *file)
+Directory::Initialize()
 {
-    file->ReadAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    DirectoryNode root;
+
+    legacy = false;
+    header.magic = DirectoryMagic;
+    header.root = 1;
+    header.height = 1;
+    header.numNodes = 2;
+    header.numEntries = 0;
+    bzero(&root, sizeof(DirectoryNode));
+    root.isLeaf = true;
+    root.count = 0;
+    WriteNode(1, &root);
+    file->WriteAt((char *) &header, sizeof(DirectoryHeader), 0);
 }
 
 //----------------------------------------------------------------------
-// Directory::WriteBack
-// 	Write any modifications to the directory back to disk
-//
-//	"file" -- file to contain the new directory contents
+// Directory::ReadNode/WriteNode
+// 	Transfer node "n" of the tree, that is, the "n"th NodeSize bytes
+//	of the file, from or to disk.
 //----------------------------------------------------------------------
 
 void
-Directory::WriteBack(OpenFile *file)
+Directory::ReadNode(int n, DirectoryNode *node)
+{
+    file->ReadAt((char *) node, sizeof(DirectoryNode), n * NodeSize);
+}
+
+void
+Directory::WriteNode(int n, DirectoryNode *node)
 {
-    file->WriteAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    file->WriteAt((char *) node, sizeof(DirectoryNode), n * NodeSize);
 }
 
 //----------------------------------------------------------------------
-// Directory::FindIndex
-// 	Look up file name in directory, and return its location in the table of
-//	directory entries.  Return -1 if the name isn't in the directory.
+// Directory::Descend
+// 	Go down the tree from the root to the leaf that holds "name", if
+//	it is in the directory at all.  Return the node number of the
+//	leaf, whose contents are left in "node".
 //
-//	"name" -- the file name to look up
+//	"name" -- the file name to look for
+//	"node" -- where to read the nodes on the way
+//	"splits" -- if not NULL, set to the number of nodes that adding
+//		"name" would create: one for each full node at the
+//		bottom of the path, and a new root if they all are
 //----------------------------------------------------------------------
 
 int
-Directory::FindIndex(const char *name)
+Directory::Descend(const char *name, DirectoryNode *node, int *splits)
 {
-    for (int i = 0; i < tableSize; i++)
-        if (table[i].inUse && !strncmp(table[i].name, name, FileNameMaxLen))
-	    return i;
-    return -1;		// name not in directory
+    int n = header.root;
+    int i, full = 0;
+
+    ReadNode(n, node);
+    while (true) {
+	if (node->count < (node->isLeaf ? LeafEntries : InnerSlots))
+	    full = 0;
+	else
+	    full++;
+	if (node->isLeaf)
+	    break;
+	for (i = node->count - 1; i > 0; i--)
+	    if (CompareNames(node->slots[i].name, name) <= 0)
+		break;
+	n = node->slots[i].child;
+	ReadNode(n, node);
+    }
+    if (splits != NULL)
+	*splits = (full == header.height) ? full + 1 : full;
+    return n;
 }
 
 //----------------------------------------------------------------------
@@ -103,43 +178,212 @@ Directory::FindIndex(const char *name)
 //	in the directory.
 //
 //	"name" -- the file name to look up
+//	"isDirectory" -- if not NULL, set to whether the file is a
+//		directory
 //----------------------------------------------------------------------
 
 int
-Directory::Find(const char *name)
+Directory::Find(const char *name, bool *isDirectory)
 {
-    int i = FindIndex(name);
+    DirectoryNode node;
+    DirectoryEntry *entry = NULL;
+    int low, high, mid, cmp;
+
+    if (legacy) {
+	int i = FindIndex(name);
 
-    if (i != -1)
-	return table[i].sector;
-    return -1;
+	if (i != -1)
+	    entry = &table[i];
+    } else {
+	Descend(name, &node);
+	for (low = 0, high = node.count - 1; low <= high; ) {
+	    mid = (low + high) / 2;
+	    cmp = CompareNames(node.entries[mid].name, name);
+	    if (cmp == 0) {
+		entry = &node.entries[mid];
+		break;
+	    } else if (cmp < 0)
+		low = mid + 1;
+	    else
+		high = mid - 1;
+	}
+    }
+    if (entry == NULL)
+	return -1;
+    if (isDirectory != NULL)
+	*isDirectory = entry->isDirectory;
+    return entry->sector;
 }
 
 //----------------------------------------------------------------------
 // Directory::Add
 // 	Add a file into the directory.  Return true if successful;
 //	return false if the file name is already in the directory, or if
-//	the directory is completely full, and has no more space for
-//	additional file names.
+//	there is no space on disk for the directory to grow (or, for a
+//	legacy directory, if its table is full).
 //
 //	"name" -- the name of the file being added
 //	"newSector" -- the disk sector containing the added file's header
+//	"isDirectory" -- is the added file a directory?
 //----------------------------------------------------------------------
 
 bool
-Directory::Add(const char *name, int newSector)
+Directory::Add(const char *name, int newSector, bool isDirectory)
 { 
-    if (FindIndex(name) != -1)
+    DirectoryEntry entry;
+    DirectoryNode root;
+    char key[FileNameMaxLen + 1];
+    int split, numSplits;
+
+    if (Find(name) != -1)
 	return false;
 
-    for (int i = 0; i < tableSize; i++)
-        if (!table[i].inUse) {
-            table[i].inUse = true;
-            strncpy(table[i].name, name, FileNameMaxLen); 
-            table[i].sector = newSector;
-        return true;
+    if (legacy) {
+	for (int i = 0; i < tableSize; i++)
+	    if (!table[i].inUse) {
+		table[i].inUse = true;
+		table[i].isDirectory = isDirectory;
+		strncpy(table[i].name, name, FileNameMaxLen); 
+		table[i].sector = newSector;
+		hashNext[i] = bucket[Hash(name)];
+		bucket[Hash(name)] = i;
+		WriteEntry(i);
+		return true;
+	    }
+	return false;	// no space
+    }
+
+    // make room first for the nodes that will be split
+    Descend(name, &root, &numSplits);
+    if (!Reserve(numSplits))
+	return false;
+    bzero(&entry, sizeof(DirectoryEntry));
+    entry.inUse = true;
+    entry.isDirectory = isDirectory;
+    entry.sector = newSector;
+    strncpy(entry.name, name, FileNameMaxLen);
+
+    split = Insert(header.root, &entry, key);
+    if (split != -1) {			// the root was split: grow a level
+	bzero(&root, sizeof(DirectoryNode));
+	root.isLeaf = false;
+	root.count = 2;
+	root.slots[0].child = header.root;
+	strncpy(root.slots[1].name, key, FileNameMaxLen + 1);
+	root.slots[1].child = split;
+	header.root = header.numNodes++;
+	header.height++;
+	WriteNode(header.root, &root);
+    }
+    header.numEntries++;
+    file->WriteAt((char *) &header, sizeof(DirectoryHeader), 0);
+    return true;
+}
+
+//----------------------------------------------------------------------
+// Directory::Reserve
+// 	Make sure the directory file is long enough to hold "numNodes"
+//	more nodes, so that once an insertion has started, it does not
+//	fail half way for lack of space.  Return false if the disk is
+//	full.
+//----------------------------------------------------------------------
+
+bool
+Directory::Reserve(int numNodes)
+{
+    int size = (header.numNodes + numNodes) * NodeSize;
+    char zero[NodeSize];
+
+    if (file->Length() >= size)
+	return true;
+    bzero(zero, NodeSize);
+    return file->WriteAt(zero, NodeSize, size - NodeSize) == NodeSize;
+}
+
+//----------------------------------------------------------------------
+// Directory::Insert
+// 	Add "entry" to the subtree whose root is node "n".  If the node
+//	overflows, split it in two, leaving the upper half in a new node
+//	at the end of the file.
+//
+//	Return the node number of the new node, and copy its smallest
+//	name into "key", if "n" was split; otherwise return -1.
+//----------------------------------------------------------------------
+
+int
+Directory::Insert(int n, DirectoryEntry *entry, char *key)
+{
+    DirectoryNode node, right;
+    char childKey[FileNameMaxLen + 1];
+    int i, split, half, rightNode;
+
+    ReadNode(n, &node);
+    bzero(&right, sizeof(DirectoryNode));
+    right.isLeaf = node.isLeaf;
+
+    if (node.isLeaf) {
+	DirectoryEntry all[LeafEntries + 1];
+
+	for (i = 0; i < node.count 
+		&& CompareNames(node.entries[i].name, entry->name) < 0; i++)
+	    all[i] = node.entries[i];
+	all[i] = *entry;
+	for (; i < node.count; i++)
+	    all[i + 1] = node.entries[i];
+	if (node.count < LeafEntries) {
+	    node.count++;
+	    for (i = 0; i < node.count; i++)
+		node.entries[i] = all[i];
+	    WriteNode(n, &node);
+	    return -1;
+	}
+	half = (LeafEntries + 1) / 2;
+	node.count = half;
+	right.count = LeafEntries + 1 - half;
+	for (i = 0; i < LeafEntries + 1; i++)
+	    if (i < half)
+		node.entries[i] = all[i];
+	    else
+		right.entries[i - half] = all[i];
+	strncpy(key, right.entries[0].name, FileNameMaxLen);
+    } else {
+	DirectoryKey all[InnerSlots + 1];
+
+	for (i = node.count - 1; i > 0; i--)
+	    if (CompareNames(node.slots[i].name, entry->name) <= 0)
+		break;
+	split = Insert(node.slots[i].child, entry, childKey);
+	if (split == -1)
+	    return -1;
+	i++;				// the new child goes right after
+	for (int j = 0; j < i; j++)
+	    all[j] = node.slots[j];
+	strncpy(all[i].name, childKey, FileNameMaxLen + 1);
+	all[i].child = split;
+	for (; i < node.count; i++)
+	    all[i + 1] = node.slots[i];
+	if (node.count < InnerSlots) {
+	    node.count++;
+	    for (i = 0; i < node.count; i++)
+		node.slots[i] = all[i];
+	    WriteNode(n, &node);
+	    return -1;
 	}
-    return false;	// no space.  Fix when we have extensible files.
+	half = (InnerSlots + 1) / 2;
+	node.count = half;
+	right.count = InnerSlots + 1 - half;
+	for (i = 0; i < InnerSlots + 1; i++)
+	    if (i < half)
+		node.slots[i] = all[i];
+	    else
+		right.slots[i - half] = all[i];
+	strncpy(key, right.slots[0].name, FileNameMaxLen);
+    }
+    key[FileNameMaxLen] = '\0';
+    rightNode = header.numNodes++;
+    WriteNode(rightNode, &right);
+    WriteNode(n, &node);
+    return rightNode;
 }
 
 //----------------------------------------------------------------------
@@ -153,45 +397,273 @@ Directory::Add(const char *name, int newSector)
 bool
 Directory::Remove(const char *name)
 { 
-    int i = FindIndex(name);
+    DirectoryNode node;
+    int n, i;
 
-    if (i == -1)
-	return false; 		// name not in directory
-    table[i].inUse = false;
-    return true;	
+    if (legacy) {
+	i = FindIndex(name);
+	if (i == -1)
+	    return false; 		// name not in directory
+	Unlink(i);
+	table[i].inUse = false;
+	WriteEntry(i);
+	return true;	
+    }
+
+    n = Descend(name, &node);
+    for (i = 0; i < node.count; i++)
+	if (!CompareNames(node.entries[i].name, name))
+	    break;
+    if (i == node.count)
+	return false;			// name not in directory
+    for (node.count--; i < node.count; i++)
+	node.entries[i] = node.entries[i + 1];
+    WriteNode(n, &node);
+    header.numEntries--;
+    file->WriteAt((char *) &header, sizeof(DirectoryHeader), 0);
+    return true;
 }
 
 //----------------------------------------------------------------------
-// Directory::List
-// 	List all the file names in the directory. 
+// Directory::IsEmpty
+// 	Return true if there are no files in the directory.
 //----------------------------------------------------------------------
 
-void
-Directory::List()
+bool
+Directory::IsEmpty()
 {
-   for (int i = 0; i < tableSize; i++)
-	if (table[i].inUse)
-	    printf("%s\n", table[i].name);
+    if (legacy) {
+	for (int i = 0; i < tableSize; i++)
+	    if (table[i].inUse)
+		return false;
+	return true;
+    }
+    return header.numEntries == 0;
 }
 
 //----------------------------------------------------------------------
-// Directory::Print
-// 	List all the file names in the directory, their FileHeader locations,
-//	and the contents of each file.  For debugging.
+// Directory::List/Print
+// 	List all the file names in the directory, in order; the names
+//	of directories are followed by a '/'.  Print also prints, for
+//	debugging, their FileHeader locations and the contents of each
+//	file.
 //----------------------------------------------------------------------
 
+void
+Directory::List()
+{
+    if (legacy) {
+	for (int i = 0; i < tableSize; i++)
+	    if (table[i].inUse)
+		printf("%.*s%s\n", FileNameMaxLen, table[i].name,
+					table[i].isDirectory ? "/" : "");
+    } else
+	Walk(header.root, false);
+}
+
 void
 Directory::Print()
 { 
-    FileHeader *hdr = new FileHeader;
-
     printf("Directory contents:\n");
-    for (int i = 0; i < tableSize; i++)
-	if (table[i].inUse) {
-	    printf("Name: %s, Sector: %d\n", table[i].name, table[i].sector);
-	    hdr->FetchFrom(table[i].sector);
+    if (legacy) {
+	FileHeader *hdr = new FileHeader;
+
+	for (int i = 0; i < tableSize; i++)
+	    if (table[i].inUse) {
+		printf("Name: %s, Sector: %d\n", table[i].name,
+							table[i].sector);
+		hdr->FetchFrom(table[i].sector);
+		hdr->Print();
+	    }
+	delete hdr;
+    } else
+	Walk(header.root, true);
+    printf("\n");
+}
+
+//----------------------------------------------------------------------
+// Directory::Walk
+// 	Visit the entries of the subtree whose root is node "n", in
+//	order of their names, to List or Print them.
+//----------------------------------------------------------------------
+
+void
+Directory::Walk(int n, bool verbose)
+{
+    DirectoryNode node;
+    DirectoryEntry *entry;
+
+    ReadNode(n, &node);
+    if (!node.isLeaf) {
+	for (int i = 0; i < node.count; i++)
+	    Walk(node.slots[i].child, verbose);
+	return;
+    }
+    for (int i = 0; i < node.count; i++) {
+	entry = &node.entries[i];
+	if (!verbose)
+	    printf("%.*s%s\n", FileNameMaxLen, entry->name,
+					entry->isDirectory ? "/" : "");
+	else {
+	    FileHeader *hdr = new FileHeader;
+
+	    printf("Name: %.*s, Sector: %d\n", FileNameMaxLen, entry->name,
+							entry->sector);
+	    hdr->FetchFrom(entry->sector);
 	    hdr->Print();
+	    delete hdr;
 	}
-    printf("\n");
-    delete hdr;
+    }
+}
+
+//----------------------------------------------------------------------
+// Directory::FindIndex
+// 	Look up file name in a legacy directory table, and return its
+//	location in the table.  Return -1 if the name isn't in the
+//	directory.
+//
+//	"name" -- the file name to look up
+//----------------------------------------------------------------------
+
+int
+Directory::FindIndex(const char *name)
+{
+    for (int i = bucket[Hash(name)]; i != -1; i = hashNext[i])
+        if (!CompareNames(table[i].name, name))
+	    return i;
+    return -1;		// name not in directory
+}
+
+//----------------------------------------------------------------------
+// Directory::Hash
+// 	Return the hash bucket for a file name; only the first
+//	FileNameMaxLen characters count, as in the comparisons.
+//----------------------------------------------------------------------
+
+int
+Directory::Hash(const char *name)
+{
+    unsigned int h = 0;
+
+    for (int i = 0; i < FileNameMaxLen && name[i] != '\0'; i++)
+	h = h * 31 + (unsigned char) name[i];
+    return h % numBuckets;
+}
+
+//----------------------------------------------------------------------
+// Directory::Unlink
+// 	Take entry "i" of a legacy table out of its hash chain.
+//----------------------------------------------------------------------
+
+void
+Directory::Unlink(int i)
+{
+    int *ptr = &bucket[Hash(table[i].name)];
+
+    while (*ptr != i)
+	ptr = &hashNext[*ptr];
+    *ptr = hashNext[i];
+}
+
+//----------------------------------------------------------------------
+// Directory::WriteEntry
+// 	Write entry "i" of a legacy table back to the directory file;
+//	only the sectors holding it are written.
+//----------------------------------------------------------------------
+
+void
+Directory::WriteEntry(int i)
+{
+    file->WriteAt((char *) &table[i], sizeof(DirectoryEntry),
+					i * sizeof(DirectoryEntry));
+}
+
+//----------------------------------------------------------------------
+// DentryCache::DentryCache
+// 	Initialize an empty cache of name lookups.
+//----------------------------------------------------------------------
+
+DentryCache::DentryCache()
+{
+    table = new Dentry[DentryCacheSize];
+    for (int i = 0; i < DentryCacheSize; i++)
+	table[i].parent = -1;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::~DentryCache
+// 	De-allocate the cache.
+//----------------------------------------------------------------------
+
+DentryCache::~DentryCache()
+{
+    delete [] table;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Slot
+// 	Return the only entry of the cache that can hold the lookup of
+//	"name" in the directory whose header is at "parent".
+//----------------------------------------------------------------------
+
+Dentry *
+DentryCache::Slot(int parent, const char *name)
+{
+    unsigned int h = parent;
+
+    for (int i = 0; i < FileNameMaxLen && name[i] != '\0'; i++)
+	h = h * 31 + (unsigned char) name[i];
+    return &table[h % DentryCacheSize];
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Lookup
+// 	Look for a cached lookup of "name" in directory "parent".  Return
+//	false if there is none; otherwise, fill in where the file's header
+//	is, and whether the file is a directory.
+//----------------------------------------------------------------------
+
+bool
+DentryCache::Lookup(int parent, const char *name, int *sector,
+						bool *isDirectory)
+{
+    Dentry *d = Slot(parent, name);
+
+    if (d->parent != parent || strncmp(d->name, name, FileNameMaxLen))
+	return false;
+    *sector = d->sector;
+    *isDirectory = d->isDirectory;
+    return true;
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Enter
+// 	Remember that "name" in directory "parent" has its header at
+//	"sector".
+//----------------------------------------------------------------------
+
+void
+DentryCache::Enter(int parent, const char *name, int sector, bool isDirectory)
+{
+    Dentry *d = Slot(parent, name);
+
+    d->parent = parent;
+    d->sector = sector;
+    d->isDirectory = isDirectory;
+    strncpy(d->name, name, FileNameMaxLen);
+    d->name[FileNameMaxLen] = '\0';
+}
+
+//----------------------------------------------------------------------
+// DentryCache::Remove
+// 	Forget the lookup of "name" in directory "parent", if cached.
+//----------------------------------------------------------------------
+
+void
+DentryCache::Remove(int parent, const char *name)
+{
+    Dentry *d = Slot(parent, name);
+
+    if (d->parent == parent && !strncmp(d->name, name, FileNameMaxLen))
+	d->parent = -1;
 }
@@ -4,7 +4,8 @@
 //      A directory is a table of pairs: <file name, sector #>,
 //	giving the name of each file in the directory, and 
 //	where to find its file header (the data structure describing
-//	where to find the file's data blocks) on disk.
+//	where to find the file's data blocks) on disk.  An entry may
+//	itself name a directory, so directories form a tree.
 //
 //      We assume mutual exclusion is provided by the caller.
 //
@@ -32,40 +33,97 @@ const int FileNameMaxLen = 9;		// for simplicity, we assume
 class DirectoryEntry {
   public:
     bool inUse;				// Is this directory entry in use?
+    bool isDirectory;			// Is the file a directory?
     int sector;				// Location on disk to find the 
 					//   FileHeader for this file 
     char name[FileNameMaxLen + 1];	// Text name for file, with +1 for 
 					// the trailing '\0'
 };
 
+// A directory file is organized as a B+-tree of nodes of NodeSize
+// bytes (one sector of the smallest size), keyed by file name.  Node
+// 0 of the file is a DirectoryHeader; the other nodes are
+// DirectoryNodes.  A leaf holds up to LeafEntries directory entries,
+// sorted by name.  An inner node holds up to InnerSlots pointers to
+// children: slot 0 points to the child with the smallest names, and
+// the name in each other slot is the smallest name found under its
+// child.
+
+class DirectoryKey {
+  public:
+    char name[FileNameMaxLen + 1];	// Smallest name under "child"
+    int child;				// Node number of a child
+};
+
+#define NodeSize	MinSectorSize
+#define LeafEntries	((int) ((NodeSize - 2 * sizeof(int)) \
+					/ sizeof(DirectoryEntry)))
+#define InnerSlots	((int) ((NodeSize - 2 * sizeof(int)) \
+					/ sizeof(DirectoryKey)))
+
+class DirectoryNode {
+  public:
+    int isLeaf;				// Is this a leaf?
+    int count;				// Entries or slots in use
+    union {
+	DirectoryEntry entries[LeafEntries];	// For a leaf
+	DirectoryKey slots[InnerSlots];		// For an inner node
+    };
+};
+
+// Directory files in the B+-tree format start with this value.
+#define DirectoryMagic	0x4e444952
+
+class DirectoryHeader {
+  public:
+    int magic;				// DirectoryMagic
+    int root;				// Node number of the root
+    int height;				// Number of levels in the tree
+    int numNodes;			// Nodes in the file, header included
+    int numEntries;			// Files in the directory
+};
+
+// Size of the file holding an empty directory: a header and an empty
+// root leaf.
+#define EmptyDirectorySize	(2 * NodeSize)
+
 // The following class defines a UNIX-like "directory".  Each entry in
 // the directory describes a file, and where to find it on disk.
 //
-// The directory data structure can be stored in memory, or on disk.
-// When it is on disk, it is stored as a regular Nachos file.
+// The directory is stored as a regular Nachos file, and a Directory
+// object works on that file directly: each operation reads and writes
+// only the nodes of the tree it needs, and its changes are on their
+// way to disk when it returns.  Looking up, adding or removing a name
+// takes time logarithmic in the number of files in the directory.
+//
+// Entries are removed from their leaf, but nodes are never merged or
+// freed; a directory file does not shrink.
 //
-// The constructor initializes a directory structure in memory; the
-// FetchFrom/WriteBack operations shuffle the directory information
-// from/to disk. 
+// Directories written by earlier versions of Nachos are flat tables of
+// DirectoryEntry, of fixed size; these are still understood, and kept
+// in memory with a hash index on the names, but cannot grow.
 
 class Directory {
   public:
-    Directory(int size); 		// Initialize an empty directory
-					// with space for "size" files
+    Directory(OpenFile *dirFile);	// Access the directory stored in
+					// "dirFile"
     ~Directory();			// De-allocate the directory
 
-    void FetchFrom(OpenFile *file);  	// Init directory contents from disk
-    void WriteBack(OpenFile *file);	// Write modifications to 
-					// directory contents back to disk
+    void Initialize();			// Make "dirFile" hold an empty
+					// directory
 
-    int Find(const char *name);		// Find the sector number of the 
-					// FileHeader for file: "name"
+    int Find(const char *name, bool *isDirectory = NULL);
+					// Find the sector number of the 
+					// FileHeader for file: "name", and
+					// whether it is a directory
 
-    bool Add(const char *name, int newSector);
+    bool Add(const char *name, int newSector, bool isDirectory = false);
     					// Add a file name into the directory
 
     bool Remove(const char *name);	// Remove a file from the directory
 
+    bool IsEmpty();			// Are there no files at all?
+
     void List();			// Print the names of all the files
 					//  in the directory
     void Print();			// Verbose print of the contents
@@ -73,12 +131,74 @@ class Directory {
 					//  names and their contents.
 
   private:
+    OpenFile *file;			// The directory file
+    DirectoryHeader header;		// Node 0 of the file
+    bool legacy;			// Is it a flat table?
+
+    void ReadNode(int n, DirectoryNode *node);	// Transfer node "n" of
+    void WriteNode(int n, DirectoryNode *node);	// the tree
+    int Descend(const char *name, DirectoryNode *node, int *splits = NULL);
+					// Find the leaf where "name" belongs
+    int Insert(int n, DirectoryEntry *entry, char *key);
+					// Add an entry to a subtree
+    bool Reserve(int numNodes);		// Make room in the file for nodes
+    void Walk(int n, bool verbose);	// List/Print a subtree
+
+    // For a directory in the legacy format:
     int tableSize;			// Number of directory entries
     DirectoryEntry *table;		// Table of pairs: 
 					// <file name, file header location> 
+    int numBuckets;			// Hash index on the names in use:
+    int *bucket;			// first entry in each bucket,
+    int *hashNext;			// and next entry in the same bucket
+					// (both -1 at the end of the chain)
 
     int FindIndex(const char *name);	// Find the index into the directory 
 					//  table corresponding to "name"
+    int Hash(const char *name);		// Bucket for "name"
+    void Unlink(int i);			// Take entry i out of the hash index
+    void WriteEntry(int i);		// Write entry i back to the file
+};
+
+// Number of entries in the cache of name lookups.
+#define DentryCacheSize		64
+
+// The following class defines a cache of the results of looking up a
+// name in a directory: a "dentry" maps <directory header sector, name>
+// to the header sector of the file with that name, so that a path can
+// be followed without reading each directory on the way from disk.
+//
+// The cache is direct-mapped: each pair can only be kept in the entry
+// it hashes to, replacing whatever was there.  It is up to the file
+// system to call Remove whenever a name disappears from a directory.
+
+class Dentry {
+  public:
+    int parent;				// Header sector of the directory,
+					// or -1 if the entry is unused
+    int sector;				// Header sector of the file
+    bool isDirectory;			// Is the file a directory?
+    char name[FileNameMaxLen + 1];	// Name of the file in "parent"
+};
+
+class DentryCache {
+  public:
+    DentryCache();			// Initialize an empty cache
+    ~DentryCache();
+
+    bool Lookup(int parent, const char *name, int *sector,
+				bool *isDirectory);
+					// Find a name; false if not cached
+    void Enter(int parent, const char *name, int sector, bool isDirectory);
+					// Remember the result of a lookup
+    void Remove(int parent, const char *name);
+					// Forget a name that is gone
+
+  private:
+    Dentry *table;			// The cached lookups
+
+    Dentry *Slot(int parent, const char *name);
+					// The entry for a pair
 };
 
 #endif // DIRECTORY_H
@@ -47,7 +47,11 @@ FileBlock::Deallocate(BitMap *freeMap)
 void
 FileBlock::FetchFrom(int sector)
 {
-    synchDisk->ReadSector(sector, (char *)this);
+    char *buffer = new char[SectorSize];
+
+    synchDisk->ReadSector(sector, buffer);
+    bcopy(buffer, (char *)this, sizeof(FileBlock));
+    delete [] buffer;
 }
 
 //----------------------------------------------------------------------
@@ -60,7 +64,12 @@ FileBlock::FetchFrom(int sector)
 void
 FileBlock::WriteBack(int sector)
 {
-    synchDisk->WriteSector(sector, (char *)this); 
+    char *buffer = new char[SectorSize];
+
+    bcopy((char *)this, buffer, sizeof(FileBlock));
+    bzero(&buffer[sizeof(FileBlock)], SectorSize - sizeof(FileBlock));
+    synchDisk->LogSector(sector, buffer); 
+    delete [] buffer;
 }
 
 //----------------------------------------------------------------------
@@ -19,7 +19,7 @@
 #include "system.h"	
 #include "filehdr.h"	
 
-#define NUM_PUNTEROS (SectorSize - sizeof(int))/sizeof(int)
+#define NUM_PUNTEROS (MinSectorSize - sizeof(int))/sizeof(int)
 
 // The following class defines the Nachos "file header" (in UNIX terms,  
 // the "i-node"), describing where on disk to find all of the data in the file.
@@ -5,9 +5,10 @@
 //	The file header is used to locate where on disk the 
 //	file's data is stored.  We implement this as a fixed size
 //	table of pointers -- each entry in the table points to the 
-//	disk sector containing that portion of the file data
-//	(in other words, there are no indirect or doubly indirect 
-//	blocks). The table size is chosen so that the file header
+//	disk sector containing that portion of the file data --
+//	followed by the sectors of a singly indirect block and of a
+//	doubly indirect block, which hold the pointers for the rest
+//	of the file.  The table size is chosen so that the file header
 //	will be just big enough to fit in one disk sector, 
 //
 //      Unlike in a real system, we do not keep track of file permissions, 
@@ -18,6 +19,11 @@
 //	     to point to the newly allocated data blocks
 //	   for a file already on disk, by reading the file header from disk
 //
+//	The data of a small enough file is kept in the header itself,
+//	and the file has no data blocks at all (cf. filehdr.h).  The
+//	parts of a file that have never been written need no data
+//	blocks either: they are holes, whose pointers are -1.
+//
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
 // of liability and disclaimer of warranty provisions.
@@ -27,6 +33,68 @@
 #include "system.h"
 #include "filehdr.h"
 
+//----------------------------------------------------------------------
+// FetchPointers
+// 	Bring a block of pointers to disk sectors into memory, so that
+//	some of them can be filled in.  If the block does not exist yet,
+//	allocate a sector for it, and start with every pointer unused.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"sector" is where the block is, or -1; it is set if it was -1
+//	"block" is the buffer for the NumIndirect pointers
+//	"goal" is where a new block should preferably go, or -1
+//----------------------------------------------------------------------
+
+static void
+FetchPointers(BitMap *freeMap, int *sector, int *block, int goal)
+{
+    if (*sector == -1) {
+	*sector = freeMap->Find(goal);
+	for (int i = 0; i < NumIndirect; i++)
+	    block[i] = -1;
+    } else
+	synchDisk->ReadSector(*sector, (char *) block);
+}
+
+//----------------------------------------------------------------------
+// ReadPointers
+// 	Bring a block of pointers to disk sectors into memory, in order
+//	to look at them.  A block that does not exist stands for a hole:
+//	every pointer in it is -1.
+//
+//	"sector" is where the block is, or -1
+//	"block" is the buffer for the NumIndirect pointers
+//----------------------------------------------------------------------
+
+static void
+ReadPointers(int sector, int *block)
+{
+    if (sector == -1) {
+	for (int i = 0; i < NumIndirect; i++)
+	    block[i] = -1;
+    } else
+	synchDisk->ReadSector(sector, (char *) block);
+}
+
+//----------------------------------------------------------------------
+// MetadataSectors
+// 	Return the number of indirect blocks a file of "numSectors" data
+//	sectors needs.
+//----------------------------------------------------------------------
+
+static int
+MetadataSectors(int numSectors)
+{
+    int count = 0;
+
+    if (numSectors > NumDirect)
+	count++;			// singly indirect block
+    if (numSectors > NumDirect + NumIndirect)
+	count += 1 + divRoundUp(numSectors - NumDirect - NumIndirect,
+							NumIndirect);
+    return count;
+}
+
 //----------------------------------------------------------------------
 // FileHeader::Allocate
 // 	Initialize a fresh file header for a newly created file.
@@ -35,82 +103,430 @@
 //	the new file.
 //
 //	"freeMap" is the bit map of free disk sectors
-//	"fileSize" is the bit map of free disk sectors
+//	"fileSize" is the number of bytes in the new file
+//	"sector" is where the header is to be kept, if known; the data
+//		sectors are placed near it
 //----------------------------------------------------------------------
 
 bool
-FileHeader::Allocate(BitMap *freeMap, int fileSize)
+FileHeader::Allocate(BitMap *freeMap, int fileSize, int sector)
 { 
-    
+    home = sector;
+    Clear();
+    if (fileSize <= MaxInlineSize) {
+	MakeInline(NULL, fileSize);	// no data sectors needed
+	return true;
+    }
     numBytes = fileSize;
-    numSectors  = divRoundUp(fileSize, SectorSize);
-    int numSectoresPunteros = numSectors - NumDirect;
-    int i  = 0;
-    if(numSectoresPunteros < 1){
-    	// no se necesitan extra
-    	if (freeMap->NumClear() < numSectors)
-		return false;		// not enough space
-
-		for (i = 0; i < numSectors; i++)
-		dataSectors[i] = freeMap->Find();
-		return true;	
-    }else{
-    	// archivo necesita mas sectores para almacenar punteros
+    return Extend(freeMap, divRoundUp(fileSize, SectorSize), NULL);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::MakeInline
+// 	Turn the header into that of a file with no data sectors, whose
+//	"length" bytes are kept in the header itself.
+//
+//	"data" -- the contents of the file, or NULL for zeros
+//	"length" -- the number of bytes in the file, at most MaxInlineSize
+//----------------------------------------------------------------------
+
+void
+FileHeader::MakeInline(const char *data, int length)
+{
+    ASSERT(length <= MaxInlineSize);
+    numBytes = length;
+    numSectors = 0;
+    magic = InlineMagic;
+    bzero(InlineData(), MaxInlineSize);
+    if (data != NULL)
+	bcopy(data, InlineData(), length);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::InlineData
+// 	Return where the data of an inline file is kept: everything in
+//	the header after the length, the number of sectors and the magic
+//	number.
+//----------------------------------------------------------------------
+
+char *
+FileHeader::InlineData()
+{
+    return (char *) &numExtents;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::IsInline
+// 	Return true if the data of the file is kept in the header.
+//----------------------------------------------------------------------
+
+bool
+FileHeader::IsInline()
+{
+    return magic == InlineMagic;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ReadInline/WriteInline
+// 	Copy the data of an inline file out of the header, as the
+//	contents of its (only) sector, with zeros after the end of the
+//	file; or change part of it, which must lie within the file.
+//
+//	"into" -- the buffer for SectorSize bytes
+//	"from" -- the new data
+//	"count" -- the number of bytes to change
+//	"position" -- the offset within the file of the first of them
+//----------------------------------------------------------------------
+
+void
+FileHeader::ReadInline(char *into)
+{
+    bcopy(InlineData(), into, MaxInlineSize);
+    bzero(&into[MaxInlineSize], SectorSize - MaxInlineSize);
+}
+
+void
+FileHeader::WriteInline(const char *from, int count, int position)
+{
+    ASSERT(position + count <= numBytes);
+    bcopy(from, &InlineData()[position], count);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Clear
+// 	Initialize the header, in the current format, for a file with
+//	no data sectors.
+//----------------------------------------------------------------------
+
+void
+FileHeader::Clear()
+{
+    numBytes = 0;
+    numSectors = 0;
+    magic = FileHeaderMagic;
+    numExtents = 0;
+    for (int i = 0; i < NumExtents; i++)
+	extentStart[i] = extentLength[i] = 0;
+    for (int i = 0; i < NumDirect; i++)
+	dataSectors[i] = -1;
+    singleIndirect = -1;
+    doubleIndirect = -1;
+}
+    
+//----------------------------------------------------------------------
+// FileHeader::Extend
+// 	Add data sectors to the end of the file, so that it has
+//	"newNumSectors" of them, allocating indirect blocks as needed.
+//	The indirect blocks are written to disk here; the header itself
+//	is left for the caller to write back.  Return false, without
+//	changing anything, if the file would be too big, or if there is
+//	not enough free space.
+//
+//	New data sectors are taken from the free map in runs of
+//	consecutive sectors, starting right after the current end of
+//	the file (or the header, for the first ones) if possible, so
+//	that the file stays contiguous, and close to its header.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"newNumSectors" is the number of data sectors wanted
+//	"sectors" if not NULL, sectors[j] is the (already allocated) disk
+//		sector to use as data sector numSectors + j; otherwise the
+//		data sectors are allocated from "freeMap"
+//----------------------------------------------------------------------
+
+bool
+FileHeader::Extend(BitMap *freeMap, int newNumSectors, int *sectors)
+{
+    int *block, *inner;
+    int count = newNumSectors - numSectors;
+    int *fresh = sectors;
+    int needed, i, j, k, start, length, goal;
    	
-	   	// cantidad de sectores para almacenar punteros
-	   	int punteros = numSectors - NumDirect;
-   		int sectoresPunteros = divRoundUp(punteros,SectorSize);
+    if (newNumSectors > MaxFileSectors)
+	return false;			// too big for the header
+    needed = MissingBlocks(numSectors, newNumSectors);
+    if (sectors == NULL)
+	needed += count;
+    if (freeMap->NumClear() < needed)
+	return false;			// not enough space
+    if (count <= 0)
+	return true;
    		
-   		if(freeMap->NumClear() < (numSectors + sectoresPunteros)){
-   			//no hay espacio
-   			return false;
-   		}else{
-   			//SI HAY CAMPO
+    block = new int[NumIndirect];
+    inner = new int[NumIndirect];
+    if (sectors == NULL) {		// allocate the data sectors in runs
+	fresh = new int[count];
+	goal = (numSectors > 0) ? 
+			ByteToSector((numSectors - 1) * SectorSize) : -1;
+	if (goal == -1)
+	    goal = home;		// no data sectors yet, or a hole
+	for (j = 0; j < count; ) {
+	    start = freeMap->FindRun(count - j, &length,
+					(goal != -1) ? goal + 1 : -1);
+	    ASSERT(start != -1);
+	    for (k = 0; k < length; k++)
+		fresh[j++] = start + k;
+	    goal = fresh[j - 1];
+	}
+    }
+    for (j = 0; j < count; j++)
+	AddToExtents(fresh[j]);
+
+    j = 0;
+    for (i = numSectors; i < newNumSectors && i < NumDirect; i++)
+	dataSectors[i] = fresh[j++];
    			
-   			// Asigna los que faltan del vector local
-   			for(i = 0; i < NumDirect; ++i){
-				dataSectors[i] = freeMap->Find();
-			}
+    if (i < newNumSectors && i < NumDirect + NumIndirect) {
+	FetchPointers(freeMap, &singleIndirect, block, home);
+	for (; i < newNumSectors && i < NumDirect + NumIndirect; i++)
+	    block[i - NumDirect] = fresh[j++];
+	synchDisk->LogSector(singleIndirect, (char *) block);
+    }
 			
-			//asigna siguiente bloque de datos
-			siguienteBloque = freeMap->Find();
+    if (i < newNumSectors) {
+	FetchPointers(freeMap, &doubleIndirect, block, home);
+	while (i < newNumSectors) {
+	    k = (i - NumDirect - NumIndirect) / NumIndirect;
+	    FetchPointers(freeMap, &block[k], inner, home);
+	    for (; i < newNumSectors 
+		   && (i - NumDirect - NumIndirect) / NumIndirect == k; i++)
+		inner[(i - NumDirect - NumIndirect) % NumIndirect] = fresh[j++];
+	    synchDisk->LogSector(block[k], (char *) inner);
+	}
+	synchDisk->LogSector(doubleIndirect, (char *) block);
+    }
 			
-			FileBlock * bloquePunteros = new FileBlock();
+    if (fresh != sectors)
+	delete [] fresh;
+    delete [] block;
+    delete [] inner;
+    numSectors = newNumSectors;
+    return true;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ExtendSparse
+// 	Add holes to the end of the file, so that it has "newNumSectors"
+//	data sectors.  Nothing is allocated, and nothing is written:
+//	the pointers past the end of the file are already -1.
+//
+//	"newNumSectors" is the number of data sectors wanted
+//----------------------------------------------------------------------
+
+void
+FileHeader::ExtendSparse(int newNumSectors)
+{
+    for (int i = numSectors; i < newNumSectors; i++)
+	AddToExtents(-1);
+    if (newNumSectors > numSectors)
+	numSectors = newNumSectors;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::MissingBlocks
+// 	Return the number of pointer blocks that do not exist yet, and
+//	would have to be allocated to give disk sectors to data sectors
+//	[from, to) of the file.
+//
+//	"from" is the first data sector
+//	"to" is one past the last one
+//----------------------------------------------------------------------
+
+int
+FileHeader::MissingBlocks(int from, int to)
+{
+    int *block;
+    int count = 0, first, last;
+
+    if (from < NumDirect)
+	from = NumDirect;		// the header has those pointers
+    if (from >= to)
+	return 0;
+    if (from < NumDirect + NumIndirect && singleIndirect == -1)
+	count++;
+    if (to > NumDirect + NumIndirect) {
+	if (from < NumDirect + NumIndirect)
+	    from = NumDirect + NumIndirect;
+	first = (from - NumDirect - NumIndirect) / NumIndirect;
+	last = (to - 1 - NumDirect - NumIndirect) / NumIndirect;
+	block = new int[NumIndirect];
+	ReadPointers(doubleIndirect, block);
+	if (doubleIndirect == -1)
+	    count++;
+	for (int k = first; k <= last; k++)
+	    if (block[k] == -1)
+		count++;
+	delete [] block;
+    }
+    return count;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::SetPointer
+// 	Make data sector "sectorNum" of the file be disk sector "sector",
+//	allocating pointer blocks as needed.  The pointer blocks are
+//	written to disk here; the header itself, and its extents, are
+//	left to the caller.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"sectorNum" is the data sector of the file
+//	"sector" is the disk sector for it
+//----------------------------------------------------------------------
+
+void
+FileHeader::SetPointer(BitMap *freeMap, int sectorNum, int sector)
+{
+    int *block, *inner;
+    int k;
+
+    if (sectorNum < NumDirect) {
+	dataSectors[sectorNum] = sector;
+	return;
+    }
+    sectorNum -= NumDirect;
+    block = new int[NumIndirect];
+    if (sectorNum < NumIndirect) {
+	FetchPointers(freeMap, &singleIndirect, block, home);
+	block[sectorNum] = sector;
+	synchDisk->LogSector(singleIndirect, (char *) block);
+    } else {
+	sectorNum -= NumIndirect;
+	k = sectorNum / NumIndirect;
+	inner = new int[NumIndirect];
+	FetchPointers(freeMap, &doubleIndirect, block, home);
+	FetchPointers(freeMap, &block[k], inner, home);
+	inner[sectorNum % NumIndirect] = sector;
+	synchDisk->LogSector(block[k], (char *) inner);
+	synchDisk->LogSector(doubleIndirect, (char *) block);
+	delete [] inner;
+    }
+    delete [] block;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::FillHole
+// 	Give disk sectors to the "count" data sectors of the file starting
+//	at "sectorNum", which are all in a hole, because they are about
+//	to be written.  They are taken in as few runs as possible, the
+//	first one right after the sector before them in the file (or the
+//	header, if that is a hole too), if possible.
+//	Return false if the disk is full; nothing is given then.
+//
+//	The free map and the pointer blocks are written back here; the
+//	header is left for the caller to write back.  The caller must
+//	not expect the new sectors to hold zeros.
+//
+//	"sectorNum" is the first data sector of the file
+//	"count" is the number of data sectors
+//	"sectors" is set to the disk sector of each of them
+//----------------------------------------------------------------------
+
+bool
+FileHeader::FillHole(int sectorNum, int count, int *sectors)
+{
+    BitMap *freeMap;
+    int goal = -1, start, length, filled = 0;
+    int *map;
+
+    ASSERT(!IsInline() && !IsLegacy() && sectorNum + count <= numSectors);
+    if (sectorNum > 0)
+	goal = ByteToSector((sectorNum - 1) * SectorSize);
+    if (goal == -1)
+	goal = home;
+    freeMap = fileSystem->LockFreeMap();
+    if (freeMap->NumClear()
+		< count + MissingBlocks(sectorNum, sectorNum + count)) {
+	fileSystem->UnlockFreeMap();
+	return false;
+    }
+    while (filled < count) {
+	start = freeMap->FindRun(count - filled, &length,
+					(goal != -1) ? goal + 1 : -1);
+	for (int i = 0; i < length; i++) {
+	    sectors[filled] = start + i;
+	    SetPointer(freeMap, sectorNum + filled, start + i);
+	    filled++;
+	}
+	goal = start + length - 1;
+    }
+    if (numExtents != -1) {		// split the extent of the hole
+	map = new int[numSectors];
+	GetBlockMap(map);		// still shows the hole
+	for (int i = 0; i < count; i++)
+	    map[sectorNum + i] = sectors[i];
+	numExtents = 0;
+	for (int i = 0; i < numSectors; i++)
+	    AddToExtents(map[i]);
+	delete [] map;
+    }
+    fileSystem->UnlockFreeMap();
+    return true;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::AddToExtents
+// 	Record "sector" as the next data sector of the file in the extent
+//	table: it either lengthens the last extent, or starts a new one.
+//	Once the file has too many extents, the table is given up, and
+//	only the sector pointers are used.
+//
+//	"sector" is the disk sector of data sector numSectors (or beyond),
+//		or -1 for a hole
+//----------------------------------------------------------------------
+
+void
+FileHeader::AddToExtents(int sector)
+{
+    int last = numExtents - 1;
+
+    if (numExtents == -1)
+	return;
+    if (numExtents > 0 && ((sector == -1) ? extentStart[last] == -1
+		: extentStart[last] != -1
+		  && extentStart[last] + extentLength[last] == sector))
+	extentLength[last]++;
+    else if (numExtents < NumExtents) {
+	extentStart[numExtents] = sector;
+	extentLength[numExtents] = 1;
+	numExtents++;
+    } else
+	numExtents = -1;		// too fragmented
+}
 			
-			int bloqueTemp = siguienteBloque;
-			int contadorAsignados = 0;
-			int contadorInterno = 0;
-			int temporal = -1;
+//----------------------------------------------------------------------
+// FileHeader::Upgrade
+// 	Convert a header in the legacy format to the current one.  The
+//	data sectors stay where they are; only the pointers to them are
+//	rearranged, and the chain of legacy pointer blocks is freed.
+//	Return false, leaving the header as it was, if there is no room
+//	for the indirect blocks.
+//
+//	"freeMap" is the bit map of free disk sectors
+//----------------------------------------------------------------------
 			
-			for(i=0; i<sectoresPunteros; ++i){
-				bloquePunteros->FetchFrom(bloqueTemp);
-				contadorInterno= 0;
-				temporal = -1;
-				while(contadorAsignados < punteros && contadorInterno < NUM_PUNTEROS){
-					//faltan bloques por asignar
-					bloquePunteros->asignar(contadorInterno, freeMap->Find());
-					++contadorInterno;
-					++contadorAsignados;					
-				}
-				//siguiente bloque
-				if(i+1 < sectoresPunteros){
-					temporal = freeMap->Find();
-					//necesito otro
-				}
-				bloquePunteros->AsignarSiguiente(temporal);
-				bloquePunteros->WriteBack(bloqueTemp);
-				bloqueTemp = temporal;
-			}
-			delete bloquePunteros;
-   		}
+bool
+FileHeader::Upgrade(BitMap *freeMap)
+{
+    int count = numSectors;
+    int length = numBytes;
+    int chained = 0;
+    int *sectors;
 
-    }
-/*
-	numSectors = 0;
-	numBytes = 0;
-	siguienteBloque = -1;
-  */
+    if (count > NumLegacyDirect)
+	chained = divRoundUp(count - NumLegacyDirect, NumDirect2);
+    if (count > MaxFileSectors
+	    || freeMap->NumClear() + chained < MetadataSectors(count))
+	return false;
+
+    sectors = new int[count];
+    GetBlockMap(sectors);
+    FreeMetadata(freeMap);
 
+    Clear();
+    numBytes = length;
+    ASSERT(Extend(freeMap, count, sectors));
+    delete [] sectors;
+    return true;
 }
 
 //----------------------------------------------------------------------
@@ -120,56 +536,65 @@ FileHeader::Allocate(BitMap *freeMap, int fileSize)
 //	"freeMap" is the bit map of free disk sectors
 //----------------------------------------------------------------------
 
-void FileHeader::Deallocate(BitMap *freeMap){
-
-	int i = 0;
-	int contadorSectores = 0;
-	if(numSectors < NumDirect){
-		//no hay bloques extra de punteros
-		for (i = 0; i < numSectors; i++) {
-			ASSERT(freeMap->Test((int) dataSectors[i]));  // ought to be marked!
-			freeMap->Clear((int) dataSectors[i]);
-    	}
-	}else{
-		//hay otros bloques
-		//borrar los que estan almacenados en el vector del fileheader
-		for (i = 0; i < NumDirect; i++) {
-			ASSERT(freeMap->Test((int) dataSectors[i]));  // ought to be marked!
-			freeMap->Clear((int) dataSectors[i]);
-			++contadorSectores;
-    	}
+void
+FileHeader::Deallocate(BitMap *freeMap)
+{
+    int *sectors;
+
+    if (IsInline())
+	return;				// nothing but the header
+    sectors = new int[numSectors];
+
+    GetBlockMap(sectors);		// no disk reads, if there are extents
+    for (int i = 0; i < numSectors; i++) {
+	if (sectors[i] == -1)
+	    continue;			// a hole
+	ASSERT(freeMap->Test(sectors[i]));	// ought to be marked!
+	freeMap->Clear(sectors[i]);
+    }
+    delete [] sectors;
+    FreeMetadata(freeMap);
+}
     	
-    	//recorrer los siguientes bloques
-    	int sector[NumDirect2+1];
-    	int numSector = siguienteBloque;
-    	int contadorBloque = 0;
+//----------------------------------------------------------------------
+// FileHeader::FreeMetadata
+// 	De-allocate the blocks of pointers of this file (but not the data
+//	sectors they point to), in either header format.
+//
+//	"freeMap" is the bit map of free disk sectors
+//----------------------------------------------------------------------
     	
-    	//cabe en un solo bloque mas?
-    	int bloquesExtra = divRoundUp((numSectors-NumDirect), NumDirect2);
+void
+FileHeader::FreeMetadata(BitMap *freeMap)
+{
+    int *block = new int[NumIndirect];
     	
-    	for(i = 0; i<bloquesExtra; ++i){
-    		// obtiene siguiente sector
-	    	synchDisk->ReadSector(numSector, (char *)sector);	//guarda en sector el contenido del siguiente bloque  
-	    	//recorre sector para desocupar cada espacio.
-	    	while(contadorSectores < numSectors && contadorBloque < NumDirect2){
-	    		ASSERT(freeMap->Test((int) sector[contadorBloque]));  // ought to be marked!
-				freeMap->Clear((int) sector[contadorBloque]);
+    if (IsLegacy()) {
+	int next = ((LegacyFileHeader *) this)->siguienteBloque;
 				
-	    		++contadorSectores;
-	    		++contadorBloque;
-	    	}
-	    	contadorBloque = 0;
-	    	++contadorSectores;
-	    	freeMap->Clear(numSector);
-	    	numSector = sector[NumDirect2];  	//siguiente sector
-    	}
+	for (int i = NumLegacyDirect; i < numSectors; i += NumDirect2) {
+	    synchDisk->ReadSector(next, (char *) block);
+	    freeMap->Clear(next);
+	    next = block[NumDirect2];
 	}	
-
+    } else {
+	if (singleIndirect != -1)
+	    freeMap->Clear(singleIndirect);
+	if (doubleIndirect != -1) {
+	    synchDisk->ReadSector(doubleIndirect, (char *) block);
+	    for (int k = 0; k < NumIndirect; k++)
+		if (block[k] != -1)
+		    freeMap->Clear(block[k]);
+	    freeMap->Clear(doubleIndirect);
+	}
+    }
+    delete [] block;
 }
 
 //----------------------------------------------------------------------
 // FileHeader::FetchFrom
-// 	Fetch contents of file header from disk. 
+// 	Fetch contents of file header from disk.  The header is at the
+//	start of its sector, which may be bigger.
 //
 //	"sector" is the disk sector containing the file header
 //----------------------------------------------------------------------
@@ -177,12 +602,18 @@ void FileHeader::Deallocate(BitMap *freeMap){
 void
 FileHeader::FetchFrom(int sector)
 {
-    synchDisk->ReadSector(sector, (char *)this);
+    char *buffer = new char[SectorSize];
+
+    synchDisk->ReadSector(sector, buffer);
+    bcopy(buffer, (char *)this, MinSectorSize);
+    home = sector;
+    delete [] buffer;
 }
 
 //----------------------------------------------------------------------
 // FileHeader::WriteBack
 // 	Write the modified contents of the file header back to disk. 
+//	Like all metadata, it goes through the journal.
 //
 //	"sector" is the disk sector to contain the file header
 //----------------------------------------------------------------------
@@ -190,8 +621,25 @@ FileHeader::FetchFrom(int sector)
 void
 FileHeader::WriteBack(int sector)
 {
-    synchDisk->WriteSector(sector, (char *)this); 
+    char *buffer = new char[SectorSize];
 	
+    home = sector;
+    bcopy((char *)this, buffer, MinSectorSize);
+    bzero(&buffer[MinSectorSize], SectorSize - MinSectorSize);
+    synchDisk->LogSector(sector, buffer); 
+    delete [] buffer;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::IsLegacy
+// 	Return true if the header was written in the legacy format, with
+//	a chain of pointer blocks.
+//----------------------------------------------------------------------
+
+bool
+FileHeader::IsLegacy()
+{
+    return magic != FileHeaderMagic && magic != InlineMagic;
 }
 
 //----------------------------------------------------------------------
@@ -201,38 +649,61 @@ FileHeader::WriteBack(int sector)
 //	offset in the file) to a physical address (the sector where the
 //	data at the offset is stored).
 //
+//	Return -1 if the byte is in a hole.
+//
 //	"offset" is the location within the file of the byte in question
 //----------------------------------------------------------------------
 
 int
 FileHeader::ByteToSector(int offset)
 {
+    int sectorNum = offset / SectorSize;
+    int *block, result;
 
-	int sectorNum = offset / SectorSize;
+    if (IsLegacy()) {			// walk the chain of pointer blocks
+	LegacyFileHeader *legacy = (LegacyFileHeader *) this;
+	int next = legacy->siguienteBloque;
 	
-	if( sectorNum < NumDirect ){
-    	return(dataSectors[sectorNum]);
-    }else{
-    //buscar sector donde esta almacenado en otro bloque
-    	int sigSec = siguienteBloque;					// Posición del siguiente sector de índices
-    	int data[NumDirect2];						// Vector para leer sectores
-    	int secBuscado = sectorNum % NumDirect2;	// El sector deseado
-    	
-    	sectorNum -= NumDirect;						// Contador para saber si falta o no recorrer otro sector de índices
+	if (sectorNum < NumLegacyDirect)
+	    return legacy->dataSectors[sectorNum];
+	sectorNum -= NumLegacyDirect;
+	block = new int[NumIndirect];
+	for (;;) {
+	    synchDisk->ReadSector(next, (char *) block);
+	    if (sectorNum < NumDirect2)
+		break;
+	    sectorNum -= NumDirect2;
+	    next = block[NumDirect2];
+	}
+	result = block[sectorNum];
+	delete [] block;
+	return result;
+    }
     	
-    	do{
-    		synchDisk->ReadSector( sigSec, (char *)data );	// Se lee el sector
-    		sectorNum -= NumDirect2;				// Se resta la cantidad de índices de este sector
-    		
-    		// Se calcula el índice del siguiente sector de índices en caso de ser necesario
-    		sigSec = data[ SectorSize - sizeof(int) ];	
-    	}
-    	while( sectorNum > 0 && sigSec != -1 ); // Asumiendo que el -1 sea el valor de un final lógico
+    if (numExtents != -1) {		// range arithmetic on the extents
+	for (int i = 0; i < numExtents; i++) {
+	    if (sectorNum < extentLength[i])
+		return (extentStart[i] == -1) ? -1 : extentStart[i] + sectorNum;
+	    sectorNum -= extentLength[i];
+	}
+	ASSERT(false);			// offset beyond the last sector
+    }
 
-    	
-    	// Se retorn el índice del sector deseado
-    	return data[secBuscado];
+    if (sectorNum < NumDirect)
+	return dataSectors[sectorNum];
+    sectorNum -= NumDirect;
+    block = new int[NumIndirect];
+    if (sectorNum < NumIndirect) {
+	ReadPointers(singleIndirect, block);
+	result = block[sectorNum];
+    } else {
+	sectorNum -= NumIndirect;
+	ReadPointers(doubleIndirect, block);
+	ReadPointers(block[sectorNum / NumIndirect], block);
+	result = block[sectorNum % NumIndirect];
     }
+    delete [] block;
+    return result;
 }
 
 //----------------------------------------------------------------------
@@ -246,6 +717,84 @@ FileHeader::FileLength()
     return numBytes;
 }
 
+//----------------------------------------------------------------------
+// FileHeader::NumDataSectors
+// 	Return the number of data sectors allocated to the file.
+//----------------------------------------------------------------------
+
+int
+FileHeader::NumDataSectors()
+{
+    return numSectors;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::GetBlockMap
+// 	Translate every sector of the file to the disk sector storing it,
+//	from the extents if the header has them, or else reading each
+//	indirect block (or, for a legacy header, each block of the chain)
+//	only once.  This lets an open file keep the whole translation in
+//	memory, rather than calling ByteToSector for every sector it reads
+//	or writes.
+//
+//	"sectors" -- array of NumDataSectors() entries to fill in; entry i is
+//		the disk sector holding bytes [i*SectorSize, (i+1)*SectorSize),
+//		or -1 if they are in a hole
+//----------------------------------------------------------------------
+
+void
+FileHeader::GetBlockMap(int *sectors)
+{
+    int *block, *inner;
+    int i, j, k;
+
+    if (IsInline())
+	return;				// no data sectors
+    if (!IsLegacy() && numExtents != -1) {
+	for (i = k = 0; k < numExtents; k++)
+	    for (j = 0; j < extentLength[k]; j++)
+		sectors[i++] = (extentStart[k] == -1) ? -1 
+						      : extentStart[k] + j;
+	return;
+    }
+
+    block = new int[NumIndirect];
+    if (IsLegacy()) {
+	LegacyFileHeader *legacy = (LegacyFileHeader *) this;
+	int next = legacy->siguienteBloque;
+
+	for (i = 0; i < numSectors && i < NumLegacyDirect; i++)
+	    sectors[i] = legacy->dataSectors[i];
+	while (i < numSectors) {
+	    synchDisk->ReadSector(next, (char *) block);
+	    for (j = 0; j < NumDirect2 && i < numSectors; j++, i++)
+		sectors[i] = block[j];
+	    next = block[NumDirect2];
+	}
+	delete [] block;
+	return;
+    }
+
+    for (i = 0; i < numSectors && i < NumDirect; i++)
+	sectors[i] = dataSectors[i];
+    if (i < numSectors) {
+	ReadPointers(singleIndirect, block);
+	for (j = 0; j < NumIndirect && i < numSectors; j++, i++)
+	    sectors[i] = block[j];
+    }
+    if (i < numSectors) {
+	inner = new int[NumIndirect];
+	ReadPointers(doubleIndirect, block);
+	for (k = 0; i < numSectors; k++) {
+	    ReadPointers(block[k], inner);
+	    for (j = 0; j < NumIndirect && i < numSectors; j++, i++)
+		sectors[i] = inner[j];
+	}
+	delete [] inner;
+    }
+    delete [] block;
+}
+
 //----------------------------------------------------------------------
 // FileHeader::Print
 // 	Print the contents of the file header, and the contents of all
@@ -257,71 +806,183 @@ FileHeader::Print()
 {
     int i, j, k;
     char *data = new char[SectorSize];
+    int *sectors = new int[numSectors];
 
-    printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes, numSectors);
+    GetBlockMap(sectors);
+    printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
     for (i = 0; i < numSectors; i++)
-    	if(i< NumDirect){
-			printf("%d ", dataSectors[i]);
-			printf("\nFile contents:\n");
-			for (i = k = 0; i < numSectors; i++) {
-				synchDisk->ReadSector(dataSectors[i], data);
-					for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++) {
-					if ('\040' <= data[j] && data[j] <= '\176')   // isprint(data[j])
-					printf("%c", data[j]);
-						else
-					printf("\\%x", (unsigned char)data[j]);
-				}
-				
-					printf("\n"); 
-			}
-    	}else{
-    		//imprime de otro sector
+	printf("%d ", sectors[i]);
+    if (IsInline())
+	printf("(inline)");
+    printf("\nFile contents:\n");
+    for (i = k = 0; i < numSectors || (i == 0 && IsInline()); i++) {
+	if (IsInline())
+	    ReadInline(data);
+	else if (sectors[i] == -1)
+	    bzero(data, SectorSize);		// a hole
+	else
+	    synchDisk->ReadSector(sectors[i], data);
+        for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++) {
+	    if ('\040' <= data[j] && data[j] <= '\176')   // isprint(data[j])
+		printf("%c", data[j]);
+            else
+		printf("\\%x", (unsigned char)data[j]);
+	}
+        printf("\n"); 
+    }
+    delete [] sectors;
+    delete [] data;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Uninline
+// 	Convert the header of an inline file to the current format, with
+//	its data copied to its first data sector, if it has any data.
+//	Return false, leaving the header as it was, if the disk is full.
+//
+//	"freeMap" is the bit map of free disk sectors
+//----------------------------------------------------------------------
+
+bool
+FileHeader::Uninline(BitMap *freeMap)
+{
+    char *data = new char[SectorSize];
+    int length = numBytes;
+    bool result = true;
 
-    		
-    	}
+    ReadInline(data);
+    Clear();
+    numBytes = length;
+    if (length > 0) {
+	if (!Extend(freeMap, 1, NULL)) {
+	    MakeInline(data, length);
+	    result = false;
+	} else
+	    synchDisk->WriteSector(dataSectors[0], data);
+    }
     delete [] data;
+    return result;
 }
 
 //-------------------------------------------------------------------------
-// FUNCION AGREGADA
-/*
-* Agrega el espacio requerido para que el tamano del archivo sea variable.	
-*/
+// FileHeader::AddLength
+// 	Make the file "n" bytes longer, allocating data sectors (and
+//	indirect blocks) for it as needed.  A header in the legacy
+//	format is first converted to the current one.  Return false if
+//	there is not enough space on disk.
+//
+//	Nothing is allocated while the new bytes fit in the sectors the
+//	file already has, or in the header of an inline file.  Otherwise
+//	the file is also given up to MaxPreallocation sectors beyond what
+//	it needs, if there is room for them.  An inline file that grows
+//	too big for its header has its data copied to its first sector.
+//
+//	"n" -- the number of bytes to add to the file
+//-------------------------------------------------------------------------
 
 bool FileHeader::AddLength(int n){
 
 	bool result = true;
-	int i = 0;
+	int newNumSectors = divRoundUp(numBytes + n, SectorSize);
+	int extra;
 	
-   	fileLock->Acquire();
-	OpenFile* bm = new 	OpenFile(0);
-    BitMap *freeMap = new BitMap(NumSectors);
-    freeMap->FetchFrom(bm);	
+	if (IsInline() && numBytes + n <= MaxInlineSize) {
+		numBytes += n;
+		return true;
+	}
+	BitMap *freeMap = fileSystem->LockFreeMap();
 	
-	int sectoresRequeridosTotal = divRoundUp(numBytes+n, SectorSize);
-	if(sectoresRequeridosTotal < NumDirect){
-		// Caben en NumDirect sectores
-		// hay suficientes disponibles 
-		if (freeMap->NumClear() < sectoresRequeridosTotal-numSectors){
+	if (IsInline() && !Uninline(freeMap))
+		result = false;
+	else if (newNumSectors > numSectors) {
+		extra = (numSectors < MaxPreallocation) ? numSectors
+							: MaxPreallocation;
+		if (newNumSectors + extra > MaxFileSectors)
+			extra = 0;
+		if (IsLegacy() && !Upgrade(freeMap))
 			result = false;
-		}else{
-			for(i = numSectors; i < sectoresRequeridosTotal; ++i){
-			// asignar los sectores que faltan
-			dataSectors[i] = freeMap->Find();
-			}
-			numBytes += n;
-			numSectors = sectoresRequeridosTotal;
-		}
-		
-	}else{
-		numSectors = 0;
-		numBytes = 0;
+		else
+			result = Extend(freeMap, newNumSectors + extra, NULL)
+			    || Extend(freeMap, newNumSectors, NULL);
 	}
+	if (result)
+		numBytes += n;
 	
-   	delete bm;
-	delete freeMap;  
-
-	fileLock->Release();  	
+	fileSystem->UnlockFreeMap();	// the new sectors are in use
      
     return result; 
 }
+
+//----------------------------------------------------------------------
+// FileHeader::AddHole
+// 	Make the file "n" bytes longer, as a hole: the new data sectors
+//	get no disk sectors until they are written, and read as zeros.
+//	Used when a file is written past its end, for the gap between
+//	the old end and the data.  Return false if the file would be
+//	too big, or if there is no room to convert its header.
+//
+//	"n" -- the number of bytes to add to the file
+//----------------------------------------------------------------------
+
+bool
+FileHeader::AddHole(int n)
+{
+    int newNumSectors = divRoundUp(numBytes + n, SectorSize);
+    bool result = true;
+
+    if (IsInline() && numBytes + n <= MaxInlineSize) {
+	numBytes += n;			// the header has zeros there
+	return true;
+    }
+    if (newNumSectors > MaxFileSectors)
+	return false;
+    if (IsInline() || IsLegacy()) {
+	BitMap *freeMap = fileSystem->LockFreeMap();
+
+	result = IsInline() ? Uninline(freeMap) : Upgrade(freeMap);
+	fileSystem->UnlockFreeMap();
+    }
+    if (result) {
+	ExtendSparse(newNumSectors);
+	numBytes += n;
+    }
+    return result;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Trim
+// 	Give back the data sectors past the end of the file, given to it
+//	in advance by AddLength, and the blocks of pointers that are no
+//	longer needed.  As in Upgrade, the data sectors that are kept
+//	stay where they are, and only the pointers to them are written
+//	again.  Return false if there was nothing to give back.
+//
+//	The free map is written back here; the header is left for the
+//	caller to write back.
+//----------------------------------------------------------------------
+
+bool
+FileHeader::Trim()
+{
+    int count = divRoundUp(numBytes, SectorSize);
+    int length = numBytes;
+    int *sectors;
+    BitMap *freeMap;
+
+    if (IsInline() || IsLegacy() || count >= numSectors)
+	return false;
+    freeMap = fileSystem->LockFreeMap();
+    sectors = new int[numSectors];
+    GetBlockMap(sectors);
+    for (int i = count; i < numSectors; i++)
+	if (sectors[i] != -1)
+	    freeMap->Clear(sectors[i]);
+    FreeMetadata(freeMap);
+
+    Clear();
+    numBytes = length;
+    ASSERT(Extend(freeMap, count, sectors));
+    delete [] sectors;
+    fileSystem->UnlockFreeMap();
+    return true;
+}
@@ -19,20 +19,85 @@
 #include "system.h"		
 #include "fileblock.h"
 
-#define NumDirect	((SectorSize - 3 * sizeof(int)) / sizeof(int))		//se modifica para dejar espacio para el puntero al siguiente bloque.
-#define MaxFileSize	(NumDirect * SectorSize)
-#define NumDirect2	((SectorSize - 1 * sizeof(int)) / sizeof(int))		//para bloques secundarios de almacenamiento de punteros.
+// A file header fits in a single disk sector (it is laid out for the
+// smallest sector size, MinSectorSize, and takes up the start of a
+// bigger sector; the blocks of pointers use whole sectors).  It holds
+// the sector numbers of the first NumDirect data sectors of the file,
+// plus the sector of a singly indirect block (the numbers of the next
+// NumIndirect data sectors) and of a doubly indirect block (the
+// numbers of up to NumIndirect singly indirect blocks).  So finding
+// any sector of a file takes at most two extra disk reads.
+//
+// Data sectors are allocated in runs of consecutive sectors, so most
+// files are made of a few "extents".  As long as a file has at most
+// NumExtents of them, the header also records each extent's first
+// sector and length, and translating an offset needs no disk reads.
+//
+// A file may have holes: data sectors that have never been written,
+// whose pointer is -1 (as is the first sector of a hole extent), and
+// which read back as zeros.  A pointer block whose pointers would all
+// be -1 need not exist either.  Holes are left by writes that start
+// past the end of the file, and the sectors of a hole get disk sectors
+// the first time they are written.
+//
+// New data sectors, and pointer blocks, are taken as close as possible
+// after the sectors before them in the file, or for the first ones,
+// after the header itself: in the same group of tracks, if there is
+// room there (see FileSystem).
+#define NumExtents	4
+#define NumIndirect	((int) (SectorSize / sizeof(int)))
+#define NumDirect	((int) ((MinSectorSize - (6 + 2 * NumExtents) \
+					* sizeof(int)) / sizeof(int)))
+#define PointerSectors	(NumDirect + NumIndirect + NumIndirect * NumIndirect)
+#define MaxFileSectors	((PointerSectors < 0x7fffffff / SectorSize) ? \
+				PointerSectors : 0x7fffffff / SectorSize)
+#define MaxFileSize	(MaxFileSectors * SectorSize)
+
+// When a file grows, it is given more sectors than it needs right now:
+// as many again as it already has, up to MaxPreallocation, so that a
+// file written a little at a time is extended only now and then.  The
+// sectors past the end of the file are counted in numSectors, and are
+// used as the file reaches them, or given back once the file is closed.
+#define MaxPreallocation	8
+
+// Headers in the format above are marked with this value, so that they
+// can be told apart from headers written in the legacy format below.
+#define FileHeaderMagic	0x4e484452
+
+// A file of at most MaxInlineSize bytes has no data sectors: its data is
+// kept in the header itself, in place of the extents and the pointers,
+// and such a header is marked with InlineMagic instead.  Reading the
+// file then takes a single disk read, and it uses a single sector.
+// Once the file grows past MaxInlineSize, it is given data sectors,
+// and its header is converted to the format above.
+#define InlineMagic	0x4e494e4c
+#define MaxInlineSize	((int) (MinSectorSize - 3 * sizeof(int)))
+
+// Earlier versions of the file system kept NumLegacyDirect pointers in
+// the header, followed by a chain of pointer blocks (see FileBlock), each
+// holding NumDirect2 pointers and the sector of the next block in the
+// chain.  Files in that format can still be read and removed, and are
+// converted to the current format the first time they grow.
+#define NumLegacyDirect	((int) ((MinSectorSize - 3 * sizeof(int)) / sizeof(int)))
+#define NumDirect2	((int) (NUM_PUNTEROS))
+
+class LegacyFileHeader {
+  public:
+    int numBytes;
+    int numSectors;
+    int dataSectors[NumLegacyDirect];
+    int siguienteBloque;
+};
 
 // The following class defines the Nachos "file header" (in UNIX terms,  
 // the "i-node"), describing where on disk to find all of the data in the file.
-// The file header is organized as a simple table of pointers to
-// data blocks. 
+// The file header is organized as a table of pointers to data blocks,
+// extended with a singly and a doubly indirect block for larger files.
 //
 // The file header data structure can be stored in memory or on disk.
 // When it is on disk, it is stored in a single sector -- this means
-// that we assume the size of this data structure to be the same
-// as one disk sector.  Without indirect addressing, this
-// limits the maximum file length to just under 4K bytes.
+// that we assume the size of this data structure, but for the sector
+// it is kept in, to be the same as one (the smallest) disk sector.
 //
 // There is no constructor; rather the file header can be initialized
 // by allocating blocks for the file (if it is a new file), or by
@@ -40,9 +105,11 @@
 
 class FileHeader {
   public:
-    bool Allocate(BitMap *bitMap, int fileSize);// Initialize a file header, 
+    bool Allocate(BitMap *bitMap, int fileSize, int sector = -1);
+						// Initialize a file header, 
 						//  including allocating space 
-						//  on disk for the file data
+						//  on disk for the file data;
+						//  it is to be kept at "sector"
     void Deallocate(BitMap *bitMap);  		// De-allocate this file's 
 						//  data blocks
 
@@ -57,15 +124,57 @@ class FileHeader {
     int FileLength();			// Return the length of the file 
 					// in bytes
 
+    int NumDataSectors();		// Return the number of data sectors
+    bool IsInline();			// Is the data kept in the header?
+    void ReadInline(char *into);	// Copy out a sector's worth of it
+    void WriteInline(const char *from, int count, int position);
+					// Change "count" bytes of it
+    void GetBlockMap(int *sectors);	// Fill in the disk sector of each
+					// data sector of the file, in order
+
     void Print();			// Print the contents of the file.
 
 	bool AddLength(int n);
+    bool AddHole(int n);		// Make the file longer, without
+					// allocating any data sectors
+    bool Trim();			// Give back the sectors past the
+					// end of the file
+    bool FillHole(int sectorNum, int count, int *sectors);
+					// Give disk sectors to sectors of
+					// the file which are a hole
+
   private:
     int numBytes;			// Number of bytes in the file
     int numSectors;			// Number of data sectors in the file
+    int magic;				// FileHeaderMagic (see above)
+    int numExtents;			// Number of extents, or -1 if
+					// there are more than NumExtents
+    int extentStart[NumExtents];	// First disk sector of each extent
+    int extentLength[NumExtents];	// Number of sectors in each extent
     int dataSectors[NumDirect];		// Disk sector numbers for each data 
 					// block in the file
-	int siguienteBloque;
+    int singleIndirect;			// Singly indirect block, or -1
+    int doubleIndirect;			// Doubly indirect block, or -1
+    int home;				// Sector the header is kept in, or
+					// -1; not itself kept on disk
+
+    bool IsLegacy();			// Is the header in the legacy format?
+    char *InlineData();			// Where inline data is kept
+    void MakeInline(const char *data, int length);
+					// Keep "data" in the header
+    void Clear();			// Make the header describe an
+					// empty file
+    bool Extend(BitMap *freeMap, int newNumSectors, int *sectors);
+					// Add data sectors to the file
+    void ExtendSparse(int newNumSectors);	// Add holes to the file
+    int MissingBlocks(int from, int to);	// Pointer blocks needed for
+						// sectors [from, to)
+    void SetPointer(BitMap *freeMap, int sectorNum, int sector);
+					// Change the pointer of one sector
+    void AddToExtents(int sector);	// Record the next data sector
+    bool Uninline(BitMap *freeMap);	// Give an inline file its sector
+    bool Upgrade(BitMap *freeMap);	// Convert a legacy header
+    void FreeMetadata(BitMap *freeMap);	// De-allocate the pointer blocks
 };
 
 #endif // FILEHDR_H
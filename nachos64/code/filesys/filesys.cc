@@ -16,28 +16,48 @@
 //      Both the bitmap and the directory are represented as normal
 //	files.  Their file headers are located in specific sectors
 //	(sector 0 and sector 1), so that the file system can find them 
-//	on bootup.
+//	on bootup.  So are the superblock (sector 2; cf. filesys.h) and
+//	the header of the journal (sector 3; cf. synchdisk.h).
 //
 //	The file system assumes that the bitmap and directory files are
-//	kept "open" continuously while Nachos is running.
+//	kept "open" continuously while Nachos is running.  The bitmap
+//	itself is also kept in memory, and is the only copy that is
+//	ever modified.
 //
 //	For those operations (such as Create, Remove) that modify the
 //	directory and/or bitmap, if the operation succeeds, the changes
-//	are written immediately back to disk (the two files are kept
-//	open during all this time).  If the operation fails, and we have
-//	modified part of the directory and/or bitmap, we simply discard
-//	the changed version, without writing it back to disk.
+//	are written back through the journal (the two files are kept
+//	open during all this time); only the sectors of the bitmap, of
+//	the directory and of the file headers that changed are written,
+//	and all of them go into the same journal transaction, so that a
+//	crash cannot leave the operation half done.  If the operation
+//	fails, changes to the bitmap are undone; the directory is only
+//	changed once nothing else can fail.
+//
+//	A disk formatted before the journal existed is used without one:
+//	its metadata is written in place.
+//
+//	Concurrent operations are kept apart by locks, which are always
+//	acquired in this order: the directory lock, held to search or
+//	change any directory; the readers/writers lock of a file (cf.
+//	openfile.h), held to read or write it; and the free map lock,
+//	held to allocate or free sectors.  So threads working on
+//	different files only wait for each other while they look up
+//	names or allocate sectors.
+//
+//	Files grow as they are written past their end (the size given to
+//	Create is only where they start), and may be sparse: a write
+//	that starts past the end leaves a hole, which takes no sectors
+//	until it is written (cf. filehdr.h).
 //
 // 	Our implementation at this point has the following restrictions:
 //
-//	   there is no synchronization for concurrent accesses
-//	   files have a fixed size, set when the file is created
-//	   files cannot be bigger than about 3KB in size
-//	   there is no hierarchical directory structure, and only a limited
-//	     number of files can be added to the system
-//	   there is no attempt to make the system robust to failures
-//	    (if Nachos exits in the middle of an operation that modifies
-//	    the file system, it may corrupt the disk)
+//	   files cannot be bigger than MaxFileSize (about 135KB with
+//	    128-byte sectors, and 2GB with 4KB sectors)
+//	   files never shrink, except for the sectors given to them in
+//	    advance, which are given back once they are closed
+//	   only the metadata is journaled: if Nachos exits in the middle
+//	    of a write, the file may hold part of the new data
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -51,19 +71,34 @@
 #include "filehdr.h"
 #include "filesys.h"
 #include "system.h"
+#include "synch.h"
 
 // Sectors containing the file headers for the bitmap of free sectors,
 // and the directory of files.  These file headers are placed in well-known 
 // sectors, so that they can be located on boot-up.
 #define FreeMapSector 		0
 #define DirectorySector 	1
-
-// Initial file sizes for the bitmap and directory; until the file system
-// supports extensible files, the directory size sets the maximum number 
-// of files that can be loaded onto the disk.
-#define FreeMapFileSize 	(NumSectors / BitsInByte)
-#define NumDirEntries 		10
-#define DirectoryFileSize 	(sizeof(DirectoryEntry) * NumDirEntries)
+#define SuperblockSector 	2
+#define JournalSector 		3
+
+// Initial file sizes for the bitmap and directory; the directory file
+// grows as files are added to it.  The bitmap is stored a word at a
+// time, and its size depends on the geometry of the disk.
+#define FreeMapFileSize 	(divRoundUp(NumSectors, BitsInWord) \
+						* (int) sizeof(unsigned))
+#define DirectoryFileSize 	EmptyDirectorySize
+
+// Number of sectors in the log of the journal.
+#define JournalSize 		64
+
+// Number of sectors in each group of tracks (see filesys.h), for a
+// disk being formatted: a whole number of tracks, at least
+// MinGroupTracks of them, so that a group has room for the files of
+// a directory or two.
+#define MinGroupTracks		8
+#define GroupSectors 		(divRoundUp(divRoundUp(NumTracks, DiskRegions), \
+					MinGroupTracks) * MinGroupTracks \
+						* SectorsPerTrack)
 
 //----------------------------------------------------------------------
 // FileSystem::FileSystem
@@ -73,32 +108,57 @@
 //	not all of the sectors marked as free).  
 //
 //	If format == false, we just have to open the files
-//	representing the bitmap and the directory.
+//	representing the bitmap and the directory.  Unless the superblock
+//	says that the disk was shut down cleanly, the journal first
+//	replays whatever changes to them had not reached their place, and
+//	the free sectors are counted; otherwise their counts are taken
+//	from the superblock, along with the size of the groups of tracks
+//	they are kept for.  Either way, the disk is then marked as in
+//	use, until Shutdown.
 //
 //	"format" -- should we initialize the disk?
+//	"delayed" -- should the files opened by Open choose the
+//		sectors for appended data only when it is flushed?
+//	"spread" -- should new directories be spread over the groups
+//		of tracks (see DirectoryGoal), or kept near their parent?
 //----------------------------------------------------------------------
 
-FileSystem::FileSystem(bool format)
+FileSystem::FileSystem(bool format, bool delayed, bool spread)
 { 
     DEBUG('f', "Initializing the file system.\n");
+    delayAllocation = delayed;
+    spreadDirectories = spread;
+    freeMapLock = new Lock("free map");
+    directoryLock = new Lock("directory");
+    dentries = new DentryCache;
     if (format) {
-        BitMap *freeMap = new BitMap(NumSectors);
-        Directory *directory = new Directory(NumDirEntries);
 	FileHeader *mapHdr = new FileHeader;
 	FileHeader *dirHdr = new FileHeader;
+	int journalStart, length;
 
         DEBUG('f', "Formatting the file system.\n");
+	freeMap = new BitMap(NumSectors, GroupSectors);
 
     // First, allocate space for FileHeaders for the directory and bitmap
     // (make sure no one else grabs these!)
 	freeMap->Mark(FreeMapSector);	    
 	freeMap->Mark(DirectorySector);
+	freeMap->Mark(SuperblockSector);
+	freeMap->Mark(JournalSector);
 
     // Second, allocate space for the data blocks containing the contents
     // of the directory and bitmap files.  There better be enough space!
 
-	ASSERT(mapHdr->Allocate(freeMap, FreeMapFileSize));
-	ASSERT(dirHdr->Allocate(freeMap, DirectoryFileSize));
+	ASSERT(mapHdr->Allocate(freeMap, FreeMapFileSize, FreeMapSector));
+	ASSERT(dirHdr->Allocate(freeMap, DirectoryFileSize, DirectorySector));
+
+    // Third, set up the journal, in consecutive sectors, so that the
+    // records written to it need no seeks.  From then on, the metadata
+    // written below goes through it.
+
+	journalStart = freeMap->FindRun(JournalSize, &length);
+	ASSERT(journalStart != -1 && length == JournalSize);
+	synchDisk->FormatJournal(JournalSector, journalStart, JournalSize);
 
     // Flush the bitmap and directory FileHeaders back to disk
     // We need to do this before we can "Open" the file, since open
@@ -115,6 +175,8 @@ FileSystem::FileSystem(bool format)
 
         freeMapFile = new OpenFile(FreeMapSector);
         directoryFile = new OpenFile(DirectorySector);
+	freeMapFile->LogWrites();
+	directoryFile->LogWrites();
      
     // Once we have the files "open", we can write the initial version
     // of each file back to disk.  The directory at this point is completely
@@ -124,34 +186,251 @@ FileSystem::FileSystem(bool format)
 
         DEBUG('f', "Writing bitmap and directory back to disk.\n");
 	freeMap->WriteBack(freeMapFile);	 // flush changes to disk
-	directory->WriteBack(directoryFile);
+	directory = new Directory(directoryFile);
+	directory->Initialize();
 
 	if (DebugIsEnabled('f')) {
 	    freeMap->Print();
 	    directory->Print();
-
-        delete freeMap; 
-	delete directory; 
+	}
 	delete mapHdr; 
 	delete dirHdr;
-	}
+
+    // Last, the superblock: the disk is formatted, and in use.
+
+	superblock.magic = SuperblockMagic;
+	superblock.version = FileSystemVersion;
+	superblock.sectorSize = SectorSize;
+	superblock.sectorsPerTrack = SectorsPerTrack;
+	superblock.numSectors = NumSectors;
+	superblock.groupSectors = GroupSectors;
+	superblock.clean = false;
+	hasSuperblock = true;
+	WriteSuperblock();
     } else {
-    // if we are not formatting the disk, just open the files representing
-    // the bitmap and directory; these are left open while Nachos is running
+	char *buffer = new char[SectorSize];
+	bool clean, counted;
+
+    // if we are not formatting the disk, read the superblock, to know
+    // whether the disk was shut down cleanly
+	synchDisk->ReadSector(SuperblockSector, buffer);
+	bcopy(buffer, (char *) &superblock, sizeof(Superblock));
+	delete [] buffer;
+	hasSuperblock = (superblock.magic == SuperblockMagic);
+	if (hasSuperblock) {
+	    ASSERT(superblock.version == FileSystemVersion);
+	    ASSERT(superblock.sectorSize == SectorSize
+			&& superblock.sectorsPerTrack == SectorsPerTrack
+			&& superblock.numSectors == NumSectors);
+	}
+	clean = hasSuperblock && superblock.clean;
+	counted = clean && superblock.groupSectors != 0;
+	if (!hasSuperblock || superblock.groupSectors == 0)
+	    superblock.groupSectors = GroupSectors;	// an older disk
+	freeMap = new BitMap(NumSectors, superblock.groupSectors);
+	DEBUG('f', "Mounting a disk %s.\n", clean ? "shut down cleanly"
+						: "that may need recovery");
+
+    // then just open the files representing the bitmap and directory;
+    // these are left open while Nachos is running
+	if (!synchDisk->OpenJournal(JournalSector, !clean))
+	    DEBUG('f', "No journal on the disk.\n");
         freeMapFile = new OpenFile(FreeMapSector);
         directoryFile = new OpenFile(DirectorySector);
+	freeMapFile->LogWrites();
+	directoryFile->LogWrites();
+	if (counted)
+	    freeMap->FetchFrom(freeMapFile, superblock.freeSectors,
+						superblock.regionFree);
+	else
+	    freeMap->FetchFrom(freeMapFile);
+	directory = new Directory(directoryFile);
+	if (hasSuperblock) {
+	    superblock.clean = false;
+	    WriteSuperblock();
+	}
+    }
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Shutdown
+// 	Record in the superblock that the disk was shut down cleanly,
+//	along with how many sectors are free; called as the machine
+//	halts, once the disk has been flushed.  The files still open
+//	are flushed first, so that nothing they keep in memory is lost
+//	when the superblock says the disk is up to date, and what they
+//	write is on disk before the superblock is queued: flushed in
+//	the same batch, sorted by sector, the superblock would go first.
+//	Disks without a superblock are left as they are, but for that.
+//----------------------------------------------------------------------
+
+void
+FileSystem::Shutdown()
+{
+    FlushOpenFiles();
+    synchDisk->Flush();
+    if (!hasSuperblock)
+	return;
+    freeMapLock->Acquire();
+    superblock.freeSectors = freeMap->NumClear();
+    for (int i = 0; i < freeMap->NumRegions(); i++)
+	superblock.regionFree[i] = freeMap->RegionClear(i);
+    freeMapLock->Release();
+    superblock.clean = true;
+    WriteSuperblock();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::WriteSuperblock
+// 	Write the superblock to disk, and wait until it is there: when
+//	the disk is marked as in use, this must happen before any other
+//	change reaches it, and when it is marked as shut down cleanly,
+//	after all of them.
+//----------------------------------------------------------------------
+
+void
+FileSystem::WriteSuperblock()
+{
+    char *buffer = new char[SectorSize];
+
+    bzero(buffer, SectorSize);
+    bcopy((char *) &superblock, buffer, sizeof(Superblock));
+    synchDisk->WriteSector(SuperblockSector, buffer);
+    synchDisk->Flush();
+    delete [] buffer;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::LockFreeMap/UnlockFreeMap
+// 	Give a caller outside the file system (a file growing, for
+//	instance) exclusive use of the in-memory bitmap of free sectors.
+//	Once the caller is done, whatever it changed is written back.
+//----------------------------------------------------------------------
+
+BitMap *
+FileSystem::LockFreeMap()
+{
+    freeMapLock->Acquire();
+    return freeMap;
+}
+
+void
+FileSystem::UnlockFreeMap()
+{
+    freeMap->WriteBack(freeMapFile);
+    freeMapLock->Release();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FetchDirectory/ReleaseDirectory
+// 	Get ready to search or change the directory whose header is at
+//	"sector"; then, once the caller is done, let go of it.  The root
+//	directory is always open; any other one is opened each time.
+//	Changes to a directory go to disk as they are made.
+//
+//	"sector" -- the location on disk of the header of the directory
+//	"file" -- set to (or, to release, the) open directory file
+//----------------------------------------------------------------------
+
+Directory *
+FileSystem::FetchDirectory(int sector, OpenFile **file)
+{
+    if (sector == DirectorySector) {
+	*file = directoryFile;
+	return directory;
+    }
+    *file = new OpenFile(sector);
+    (*file)->LogWrites();
+    return new Directory(*file);
+}
+
+void
+FileSystem::ReleaseDirectory(Directory *dir, OpenFile *file)
+{
+    if (dir != directory) {
+	delete dir;
+	delete file;
+    }
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Lookup
+// 	Find "name" in the directory whose header is at "parent".  Return
+//	the sector of its header, or -1 if there is no such name; also
+//	set "isDirectory" to tell whether it is a directory.
+//
+//	Lookups are remembered in the dentry cache, so looking the same
+//	name up again needs no disk I/O.
+//----------------------------------------------------------------------
+
+int
+FileSystem::Lookup(int parent, const char *name, bool *isDirectory)
+{
+    Directory *dir;
+    OpenFile *file;
+    int sector;
+
+    if (dentries->Lookup(parent, name, &sector, isDirectory))
+	return sector;
+    dir = FetchDirectory(parent, &file);
+    sector = dir->Find(name, isDirectory);
+    ReleaseDirectory(dir, file);
+    if (sector != -1)
+	dentries->Enter(parent, name, sector, *isDirectory);
+    return sector;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FindParent
+// 	Follow a path name such as "a/b/c" (or "/a/b/c"; every path
+//	starts at the root directory) down to the directory holding its
+//	last component.  Return the sector of the header of that
+//	directory, or -1 if some directory on the way does not exist.
+//
+//	"path" -- the path name
+//	"name" -- set to the last component of the path, which is empty
+//		if the path names the root directory
+//----------------------------------------------------------------------
+
+int
+FileSystem::FindParent(const char *path, char *name)
+{
+    int parent = DirectorySector;
+    const char *end;
+    bool isDirectory;
+    int length;
+
+    for (;;) {
+	while (*path == '/')
+	    path++;
+	for (end = path; *end != '/' && *end != '\0'; end++)
+	    ;
+	length = (end - path < FileNameMaxLen) ? end - path : FileNameMaxLen;
+	strncpy(name, path, length);
+	name[length] = '\0';
+	while (*end == '/')
+	    end++;
+	if (*end == '\0')
+	    return parent;		// "name" is the last component
+	parent = Lookup(parent, name, &isDirectory);
+	if (parent == -1 || !isDirectory)
+	    return -1;
+	path = end;
     }
 }
 
 //----------------------------------------------------------------------
 // FileSystem::Create
 // 	Create a file in the Nachos file system (similar to UNIX create).
-//	Since we can't increase the size of files dynamically, we have
-//	to give Create the initial size of the file.
+//	The file is given sectors for "initialSize" bytes at once; it
+//	grows from there as it is written.
 //
 //	The steps to create a file are:
+//	  Find the directory that is to hold it, by following the path
 //	  Make sure the file doesn't already exist
-//        Allocate a sector for the file header
+//        Allocate a sector for the file header (near the directory,
+//	    or for a new directory, in a group of tracks with room,
+//	    unless spreadDirectories is off)
 // 	  Allocate space on disk for the data blocks for the file
 //	  Add the name to the directory
 //	  Store the new file header on disk 
@@ -160,61 +439,116 @@ FileSystem::FileSystem(bool format)
 //	Return true if everything goes ok, otherwise, return false.
 //
 // 	Create fails if:
+//		a directory on the path does not exist
 //   		file is already in directory
 //	 	no free space for file header
 //	 	no free entry for file in directory
 //	 	no free space for data blocks for the file 
 //
-// 	Note that this implementation assumes there is no concurrent access
-//	to the file system!
+// 	Concurrent calls to Create and Remove are serialized by the
+//	directory lock.
 //
-//	"name" -- name of file to be created
+//	"name" -- path name of file to be created
 //	"initialSize" -- size of file to be created
 //----------------------------------------------------------------------
 
 bool
 FileSystem::Create(const char *name, int initialSize=0)
 {
-    Directory *directory;
-    BitMap *freeMap;
-    FileHeader *hdr;
-    int sector;
-    bool success;
-
     DEBUG('f', "Creating file %s, size %d\n", name, initialSize);
+    return CreateEntry(name, initialSize, false);
+}
 
-	//fileLock->Acquire();
-    directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
+//----------------------------------------------------------------------
+// FileSystem::CreateDirectory
+// 	Create an empty directory (similar to UNIX mkdir).  A directory
+//	is a file holding a Directory, just like the root directory.
+//
+//	Return true if everything goes ok, otherwise, return false, for
+//	the same reasons as Create.
+//
+//	"name" -- path name of directory to be created
+//----------------------------------------------------------------------
 
-    if (directory->Find(name) != -1)
+bool
+FileSystem::CreateDirectory(const char *name)
+{
+    DEBUG('f', "Creating directory %s\n", name);
+    return CreateEntry(name, DirectoryFileSize, true);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::CreateEntry
+// 	Do the work of Create and CreateDirectory.
+//
+//	"path" -- path name of the new file
+//	"initialSize" -- size of the new file
+//	"isDirectory" -- should the new file be an (empty) directory?
+//----------------------------------------------------------------------
+
+bool
+FileSystem::CreateEntry(const char *path, int initialSize, bool isDirectory)
+{
+    Directory *dir;
+    OpenFile *dirFile;
+    FileHeader *hdr;
+    char name[FileNameMaxLen + 1];
+    int parent, sector;
+    bool success;
+
+    directoryLock->Acquire();
+    parent = FindParent(path, name);
+    if (parent == -1 || name[0] == '\0') {
+	directoryLock->Release();
+	return false;			// no such directory
+    }
+    dir = FetchDirectory(parent, &dirFile);
+    if (dir->Find(name) != -1)
       success = false;			// file is already in directory
     else {	
-        freeMap = new BitMap(NumSectors);
-        freeMap->FetchFrom(freeMapFile);
-        sector = freeMap->Find();	// find a sector to hold the file header
+    	hdr = new FileHeader;
+	synchDisk->BeginOperation();
+        freeMapLock->Acquire();
+					// find a sector to hold the file header
+        sector = freeMap->Find((isDirectory && spreadDirectories) ?
+						DirectoryGoal(parent) : parent);
     	if (sector == -1) 		
             success = false;		// no free block for file header 
-        else if (!directory->Add(name, sector))
-            success = false;	// no space in directory
-	else {
-    	    hdr = new FileHeader;
-	    if (!hdr->Allocate(freeMap, initialSize)){
-            	success = false;	// no space on disk for data
-            	printf("Falla allocate ");
-	   } else {	
-	    	success = true;
-		// everthing worked, flush all changes back to disk
-    	    	hdr->WriteBack(sector); 		
-    	    	directory->WriteBack(directoryFile);
-    	    	freeMap->WriteBack(freeMapFile);
+	else if (!hdr->Allocate(freeMap, initialSize, sector)) {
+            success = false;		// no space on disk for data
+	    freeMap->Clear(sector);
+	} else
+	    success = true;
+	freeMap->WriteBack(freeMapFile);	// flush changes to disk
+        freeMapLock->Release();		// the directory may need to grow
+
+	if (success) {
+    	    hdr->WriteBack(sector); 		
+	    if (isDirectory) {
+		OpenFile *newFile = new OpenFile(sector);
+		Directory *newDir;
+
+		newFile->LogWrites();
+		newDir = new Directory(newFile);
+		newDir->Initialize();		// no entries yet
+		delete newDir;
+		delete newFile;
 	    }
-            delete hdr;
+	    if (!dir->Add(name, sector, isDirectory)) {
+		success = false;	// no space for the directory to grow
+		freeMapLock->Acquire();
+		hdr->Deallocate(freeMap);
+		freeMap->Clear(sector);
+		freeMap->WriteBack(freeMapFile);
+		freeMapLock->Release();
+	    } else
+		dentries->Enter(parent, name, sector, isDirectory);
 	}
-        delete freeMap;
+	synchDisk->EndOperation();
+	delete hdr;
     }
- //   fileLock->Release();
-    delete directory;
+    ReleaseDirectory(dir, dirFile);
+    directoryLock->Release();
     return success;
 }
 
@@ -222,29 +556,82 @@ FileSystem::Create(const char *name, int initialSize=0)
 // FileSystem::Open
 // 	Open a file for reading and writing.  
 //	To open a file:
-//	  Find the location of the file's header, using the directory 
+//	  Find the location of the file's header, by following the path
+//	    through the directories
 //	  Bring the header into memory
 //
-//	"name" -- the text name of the file to be opened
+//	The root directory is kept in memory, and the names found in the
+//	other directories are cached, so often this needs no disk I/O.
+//	Directories cannot be opened.
+//
+//	Small writes to the file are combined in memory.  The files the
+//	file system keeps open itself -- the bitmap and the directories
+//	-- are not opened here, and are written through, so that their
+//	changes reach the disk as each operation ends.
+//
+//	"name" -- the path name of the file to be opened
 //----------------------------------------------------------------------
 
 OpenFile *
 FileSystem::Open(const char *name)
 { 
-    Directory *	directory = new Directory(NumDirEntries);
     OpenFile *openFile = NULL;
+    char last[FileNameMaxLen + 1];
+    bool isDirectory;
     int sector;
-	//fileLock->Acquire();
+
     DEBUG('f', "Opening file %s\n", name);
-    directory->FetchFrom(directoryFile);
-    sector = directory->Find(name); 
-    if (sector >= 0) 		
+    directoryLock->Acquire();
+    sector = FindParent(name, last);
+    if (sector != -1 && last[0] != '\0')
+	sector = Lookup(sector, last, &isDirectory);
+    else
+	sector = -1;
+    directoryLock->Release();
+    if (sector >= 0 && !isDirectory) {
 	openFile = new OpenFile(sector);	// name was found in directory 
-    delete directory;
-    //fileLock->Release();
+	openFile->CombineWrites();
+	if (delayAllocation)
+	    openFile->DelayAllocation();
+    }
     return openFile;				// return NULL if not found
 }
 
+//----------------------------------------------------------------------
+// FileSystem::DirectoryGoal
+// 	Return where a new directory should go: at the start of the group
+//	of tracks nearest that of its parent, with at least the average
+//	number of free sectors.  So directories stay close together while
+//	there is room, and move on to other groups as those fill up,
+//	each with room for its files around it.  The caller must hold
+//	the free map lock.
+//
+//	This makes reading a directory's files cheaper, but writing them
+//	dearer: every operation also changes the free map and the journal,
+//	which stay in the first group.  It can be turned off (-dn).
+//
+//	"parent" -- the sector of the header of the parent directory
+//----------------------------------------------------------------------
+
+int
+FileSystem::DirectoryGoal(int parent)
+{
+    int numGroups = freeMap->NumRegions();
+    int average = freeMap->NumClear() / numGroups;
+    int group = parent / superblock.groupSectors;
+    int i;
+
+    for (int distance = 0; distance < numGroups; distance++) {
+	i = group + distance;
+	if (i < numGroups && freeMap->RegionClear(i) >= average)
+	    return freeMap->RegionStart(i);
+	i = group - distance;
+	if (distance > 0 && i >= 0 && freeMap->RegionClear(i) >= average)
+	    return freeMap->RegionStart(i);
+    }
+    return parent;			// not reached
+}
+
 //----------------------------------------------------------------------
 // FileSystem::Remove
 // 	Delete a file from the file system.  This requires:
@@ -254,43 +641,93 @@ FileSystem::Open(const char *name)
 //	    Write changes to directory, bitmap back to disk
 //
 //	Return true if the file was deleted, false if the file wasn't
-//	in the file system.
+//	in the file system (or is a directory).
 //
-//	"name" -- the text name of the file to be removed
+//	"name" -- the path name of the file to be removed
 //----------------------------------------------------------------------
 
 bool
 FileSystem::Remove(const char *name)
 { 
-    Directory *directory;
-    BitMap *freeMap;
+    return RemoveEntry(name, false);
+} 
+
+//----------------------------------------------------------------------
+// FileSystem::RemoveDirectory
+// 	Delete a directory from the file system (similar to UNIX rmdir).
+//	Return false if there is no such directory, if it is not empty,
+//	or if it is the root directory.
+//
+//	"name" -- the path name of the directory to be removed
+//----------------------------------------------------------------------
+
+bool
+FileSystem::RemoveDirectory(const char *name)
+{ 
+    return RemoveEntry(name, true);
+} 
+
+//----------------------------------------------------------------------
+// FileSystem::RemoveEntry
+// 	Do the work of Remove and RemoveDirectory.
+//
+//	"path" -- the path name of the file to be removed
+//	"isDirectory" -- is it to be a directory?
+//----------------------------------------------------------------------
+
+bool
+FileSystem::RemoveEntry(const char *path, bool isDirectory)
+{ 
+    Directory *dir;
+    OpenFile *dirFile;
     FileHeader *fileHdr;
-    int sector;
+    char name[FileNameMaxLen + 1];
+    int parent, sector;
+    bool found;
     
-    //fileLock->Acquire();
-    directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
-    sector = directory->Find(name);
-    if (sector == -1) {
-       delete directory;
-       return false;			 // file not found 
+    directoryLock->Acquire();
+    parent = FindParent(path, name);
+    if (parent == -1 || name[0] == '\0') {
+	directoryLock->Release();
+	return false;			// no such directory, or the root
+    }
+    dir = FetchDirectory(parent, &dirFile);
+    sector = dir->Find(name, &found);
+    if (sector == -1 || found != isDirectory) {
+	ReleaseDirectory(dir, dirFile);
+	directoryLock->Release();
+	return false;			 // file not found 
+    }
+    if (isDirectory) {
+	OpenFile *file;
+	Directory *removed = FetchDirectory(sector, &file);
+	bool empty = removed->IsEmpty();
+
+	ReleaseDirectory(removed, file);
+	if (!empty) {
+	    ReleaseDirectory(dir, dirFile);
+	    directoryLock->Release();
+	    return false;		// directory not empty
+	}
     }
+    ForgetInode(sector);			// the header on disk is current
+    synchDisk->BeginOperation();
     fileHdr = new FileHeader;
     fileHdr->FetchFrom(sector);
 
-    freeMap = new BitMap(NumSectors);
-    freeMap->FetchFrom(freeMapFile);
+    dir->Remove(name);
+    dentries->Remove(parent, name);
 
+    freeMapLock->Acquire();
     fileHdr->Deallocate(freeMap);  		// remove data blocks
     freeMap->Clear(sector);			// remove header block
-    directory->Remove(name);
 
     freeMap->WriteBack(freeMapFile);		// flush to disk
-    directory->WriteBack(directoryFile);        // flush to disk
+    freeMapLock->Release();
+    synchDisk->EndOperation();
+    ReleaseDirectory(dir, dirFile);		// flush to disk
+    directoryLock->Release();
     delete fileHdr;
-    delete directory;
-    delete freeMap;
-    //fileLock->Release();
     return true;
 } 
 
@@ -302,12 +739,9 @@ FileSystem::Remove(const char *name)
 void
 FileSystem::List()
 {
-    Directory *directory = new Directory(NumDirEntries);
-	//fileLock->Acquire();
-    directory->FetchFrom(directoryFile);
+    directoryLock->Acquire();
     directory->List();
-    delete directory;
-	//fileLock->Release();
+    directoryLock->Release();
 }
 
 //----------------------------------------------------------------------
@@ -325,10 +759,7 @@ FileSystem::Print()
 {
     FileHeader *bitHdr = new FileHeader;
     FileHeader *dirHdr = new FileHeader;
-    BitMap *freeMap = new BitMap(NumSectors);
-    Directory *directory = new Directory(NumDirEntries);
 
-	//fileLock->Acquire();
     printf("Bit map file header:\n");
     bitHdr->FetchFrom(FreeMapSector);
     bitHdr->Print();
@@ -337,15 +768,14 @@ FileSystem::Print()
     dirHdr->FetchFrom(DirectorySector);
     dirHdr->Print();
 
-    freeMap->FetchFrom(freeMapFile);
+    freeMapLock->Acquire();
     freeMap->Print();
+    freeMapLock->Release();
 
-    directory->FetchFrom(directoryFile);
+    directoryLock->Acquire();
     directory->Print();
+    directoryLock->Release();
 
     delete bitHdr;
     delete dirHdr;
-    delete freeMap;
-    delete directory;
-	//fileLock->Release();
 } 
@@ -20,13 +20,14 @@
 //	file system (in a file named "DISK"). 
 //
 //	In the "real" implementation, there are two key data structures used 
-//	in the file system.  There is a single "root" directory, listing
-//	all of the files in the file system; unlike UNIX, the baseline
-//	system does not provide a hierarchical directory structure.  
+//	in the file system.  There is a "root" directory, listing files
+//	and other directories; as in UNIX, a file is named by its path
+//	from the root, such as "a/b/c".
 //	In addition, there is a bitmap for allocating
 //	disk sectors.  Both the root directory and the bitmap are themselves
 //	stored as files in the Nachos file system -- this causes an interesting
 //	bootstrap problem when the simulated disk is initialized. 
+//	Last, a superblock describes the file system as a whole.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -43,7 +44,7 @@
 				// implementation is available
 class FileSystem {
   public:
-    FileSystem(bool format) {}
+    FileSystem(bool format, bool delayed = false, bool spread = true) {}
 
     bool Create(const char *name, int initialSize) { 
 	int fileDescriptor = OpenForWrite(name);
@@ -65,14 +66,55 @@ class FileSystem {
 };
 
 #else // FILESYS
+#include "disk.h"
+
+// The superblock is kept in a sector of its own, and read first when
+// the disk is mounted.  It tells which format and geometry the disk
+// was made for, and whether it was shut down cleanly; if so, the free
+// sector counts it holds are up to date, and mounting needs neither
+// to replay the journal nor to count the free sectors.
+#define SuperblockMagic		0x4e535042
+#define FileSystemVersion	1
+
+// The disk is divided into at most this many groups of consecutive
+// tracks, and the superblock keeps the number of free sectors in each.
+// Files are kept in the same group as the directory they are in, and
+// their data in the same group as their header, so that using the
+// files of a directory takes short seeks; new directories are spread
+// over the groups as they fill up, to leave room for that.
+#define DiskRegions		16
+
+class Superblock {
+  public:
+    int magic;				// SuperblockMagic
+    int version;			// FileSystemVersion
+    int sectorSize;			// The geometry of the disk
+    int sectorsPerTrack;
+    int numSectors;
+    int clean;				// Was the disk shut down cleanly
+					// (and not mounted since)?
+    int freeSectors;			// Number of free sectors, and of free
+    int regionFree[DiskRegions];	// sectors in each region, when clean
+    int groupSectors;			// Sectors in each region, or 0 on
+					// disks formatted before groups
+};
+
+class BitMap;
+class Directory;
+class DentryCache;
+class Lock;
+
 class FileSystem {
   public:
-    FileSystem(bool format);		// Initialize the file system.
+    FileSystem(bool format, bool delayed = false, bool spread = true);
+					// Initialize the file system.
 					// Must be called *after* "synchDisk" 
 					// has been initialized.
     					// If "format", there is nothing on
 					// the disk, so initialize the directory
     					// and the bitmap of free blocks.
+					// If "delayed", files opened
+					// get their new sectors at flush time
 
     bool Create(const char *name, int initialSize);  	
 					// Create a file (UNIX creat)
@@ -81,15 +123,57 @@ class FileSystem {
 
     bool Remove(const char *name);  	// Delete a file (UNIX unlink)
 
+    bool CreateDirectory(const char *name);	// Create an empty directory
+						// (UNIX mkdir)
+    bool RemoveDirectory(const char *name);	// Delete an empty directory
+						// (UNIX rmdir)
+
     void List();			// List all the files in the file system
 
     void Print();			// List all the files and their contents
 
+    void Shutdown();			// Flush the open files, and mark the
+					// disk as shut down cleanly; called
+					// by Interrupt::Halt
+
+    BitMap *LockFreeMap();		// Get exclusive use of the bitmap
+					// of free disk blocks
+    void UnlockFreeMap();		// Write the changes to the bitmap
+					// back to disk, and release it
+
   private:
+   Superblock superblock;		// As on disk, while mounted
+   bool hasSuperblock;			// False on disks formatted before
+					// superblocks existed
    OpenFile* freeMapFile;		// Bit map of free disk blocks,
 					// represented as a file
+   BitMap *freeMap;			// The same bit map, kept in memory
+					// while Nachos is running
+   Lock *freeMapLock;			// Serializes changes to freeMap
    OpenFile* directoryFile;		// "Root" directory -- list of 
 					// file names, represented as a file
+   Directory *directory;		// The same directory, always ready
+   Lock *directoryLock;			// Serializes use of "directory",
+					// and changes to any directory
+   DentryCache *dentries;		// Recent name lookups
+   bool delayAllocation;		// Do open files delay allocation?
+   bool spreadDirectories;		// Do new directories go to other
+					// groups, as theirs fills up?
+
+   void WriteSuperblock();		// Write "superblock" to disk, at once
+   int DirectoryGoal(int parent);	// Where to put a new directory
+   Directory *FetchDirectory(int sector, OpenFile **file);
+					// Bring a directory into memory
+   void ReleaseDirectory(Directory *dir, OpenFile *file);
+					// Let go of it
+   int Lookup(int parent, const char *name, bool *isDirectory);
+					// Find a name in a directory
+   int FindParent(const char *path, char *name);
+					// Follow a path to its directory
+   bool CreateEntry(const char *path, int initialSize, bool isDirectory);
+   bool RemoveEntry(const char *path, bool isDirectory);
+					// Common code of Create/Remove and
+					// CreateDirectory/RemoveDirectory
 };
 
 #endif // FILESYS
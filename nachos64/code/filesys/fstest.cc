@@ -7,6 +7,10 @@
 //	   Perftest -- a stress test for the Nachos file system
 //		read and write a really large file in tiny chunks
 //		(won't work on baseline system!)
+//	   ManyFilesTest -- measure the seeks made using many small
+//		files, in several directories
+//	   SharedFileTest -- check that two opens of a file see each
+//		other's writes
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -183,3 +187,195 @@ PerformanceTest()
     stats->Print();
 }
 
+//----------------------------------------------------------------------
+// ManyFilesTest
+// 	Measure how far the disk head moves when many small files are
+//	used, as in most workloads, on a disk that has been in use for a
+//	while.  First the disk is aged: AgeFiles files are written, and
+//	every other one removed, leaving holes all over the part of the
+//	disk in use.  Then NumTestDirs directories are created, and
+//	FilesPerDir files written in each, a directory at a time; the
+//	files are read back, a directory at a time, and everything is
+//	removed.  The seeks made by the writing and the reading are
+//	printed.
+//----------------------------------------------------------------------
+
+#define AgeFiles	16
+#define NumTestDirs	4
+#define FilesPerDir	8
+#define SmallFileSize	((int)(ContentSize * 100))
+
+static bool
+ManyFilesWrite(const char *name)
+{
+    OpenFile *openFile;
+
+    if (!fileSystem->Create(name, 0)
+		|| (openFile = fileSystem->Open(name)) == NULL) {
+	printf("Many files test: unable to create %s\n", name);
+	return false;
+    }
+    for (int i = 0; i < SmallFileSize; i += ContentSize)
+	if (openFile->Write(Contents, ContentSize) < (int) ContentSize) {
+	    printf("Many files test: unable to write %s\n", name);
+	    delete openFile;
+	    return false;
+	}
+    delete openFile;
+    return true;
+}
+
+static bool
+ManyFilesRead(const char *name)
+{
+    OpenFile *openFile;
+    char buffer[ContentSize];
+
+    if ((openFile = fileSystem->Open(name)) == NULL) {
+	printf("Many files test: unable to open %s\n", name);
+	return false;
+    }
+    for (int i = 0; i < SmallFileSize; i += ContentSize)
+	if (openFile->Read(buffer, ContentSize) < (int) ContentSize
+		|| strncmp(buffer, Contents, ContentSize)) {
+	    printf("Many files test: unable to read %s\n", name);
+	    delete openFile;
+	    return false;
+	}
+    delete openFile;
+    return true;
+}
+
+static void
+PrintSeeks(const char *phase, int seeks, int tracks)
+{
+    printf("%s: disk seeks %d, tracks crossed %d\n", phase,
+		stats->numDiskSeeks - seeks, stats->numSeekTracks - tracks);
+}
+
+void
+ManyFilesTest()
+{
+    char name[32];
+    int d, f, seeks, tracks;
+    bool ok = true;
+
+    printf("Many files test: %d directories of %d files of %d bytes\n",
+		NumTestDirs, FilesPerDir, SmallFileSize);
+    for (f = 0; f < AgeFiles && ok; f++) {
+	sprintf(name, "AgeFile%d", f);
+	ok = ManyFilesWrite(name);
+    }
+    for (f = 0; f < AgeFiles; f += 2) {
+	sprintf(name, "AgeFile%d", f);
+	fileSystem->Remove(name);
+    }
+    for (d = 0; d < NumTestDirs; d++) {
+	sprintf(name, "ManyDir%d", d);
+	if (!fileSystem->CreateDirectory(name)) {
+	    printf("Many files test: unable to create %s\n", name);
+	    return;
+	}
+    }
+
+    seeks = stats->numDiskSeeks;
+    tracks = stats->numSeekTracks;
+    for (d = 0; d < NumTestDirs && ok; d++)
+	for (f = 0; f < FilesPerDir && ok; f++) {
+	    sprintf(name, "ManyDir%d/File%d", d, f);
+	    ok = ManyFilesWrite(name);
+	}
+    synchDisk->Flush();
+    PrintSeeks("Write", seeks, tracks);
+
+    seeks = stats->numDiskSeeks;
+    tracks = stats->numSeekTracks;
+    for (d = 0; d < NumTestDirs && ok; d++)
+	for (f = 0; f < FilesPerDir && ok; f++) {
+	    sprintf(name, "ManyDir%d/File%d", d, f);
+	    ok = ManyFilesRead(name);
+	}
+    PrintSeeks("Read", seeks, tracks);
+
+    for (d = 0; d < NumTestDirs; d++) {
+	for (f = 0; f < FilesPerDir; f++) {
+	    sprintf(name, "ManyDir%d/File%d", d, f);
+	    fileSystem->Remove(name);
+	}
+	sprintf(name, "ManyDir%d", d);
+	fileSystem->RemoveDirectory(name);
+    }
+    for (f = 1; f < AgeFiles; f += 2) {
+	sprintf(name, "AgeFile%d", f);
+	fileSystem->Remove(name);
+    }
+    stats->Print();
+}
+
+//----------------------------------------------------------------------
+// SharedFileTest
+// 	Check that two opens of the same file see each other's writes,
+//	with delayed allocation (-da) as well as without it.  The first
+//	open writes SharedHalf bytes of 'A' at the start of a short
+//	file, and the second as many of 'B' right after them; each
+//	write is past the sectors the file has, so with -da it is kept
+//	in memory.  The second open must read both halves, before and
+//	after the first is closed, and so must a new open once both are
+//	closed.
+//----------------------------------------------------------------------
+
+#define SharedFileName	"SharedFile"
+#define SharedHalf	1000
+
+static bool
+SharedFileCheck(OpenFile *openFile, const char *when)
+{
+    char *buffer = new char[2 * SharedHalf];
+    bool ok = (openFile->Length() == 2 * SharedHalf
+		&& openFile->ReadAt(buffer, 2 * SharedHalf, 0)
+							== 2 * SharedHalf);
+
+    for (int i = 0; i < 2 * SharedHalf && ok; i++)
+	ok = (buffer[i] == ((i < SharedHalf) ? 'A' : 'B'));
+    if (!ok)
+	printf("Shared file test: wrong contents %s\n", when);
+    delete [] buffer;
+    return ok;
+}
+
+void
+SharedFileTest()
+{
+    OpenFile *first, *second;
+    char *buffer = new char[SharedHalf];
+    bool ok;
+
+    printf("Shared file test: two opens writing a %d byte file\n",
+		2 * SharedHalf);
+    if (!fileSystem->Create(SharedFileName, 200)
+		|| (first = fileSystem->Open(SharedFileName)) == NULL) {
+	printf("Shared file test: unable to create %s\n", SharedFileName);
+	delete [] buffer;
+	return;
+    }
+    second = fileSystem->Open(SharedFileName);
+    memset(buffer, 'A', SharedHalf);
+    ok = (first->WriteAt(buffer, SharedHalf, 0) == SharedHalf);
+    memset(buffer, 'B', SharedHalf);
+    ok = ok && (second->WriteAt(buffer, SharedHalf, SharedHalf)
+							== SharedHalf);
+    if (!ok)
+	printf("Shared file test: unable to write %s\n", SharedFileName);
+    ok = ok && SharedFileCheck(second, "while both are open");
+    delete first;
+    ok = ok && SharedFileCheck(second, "once the first is closed");
+    delete second;
+    if (ok && (first = fileSystem->Open(SharedFileName)) != NULL) {
+	ok = SharedFileCheck(first, "once both are closed");
+	delete first;
+    }
+    if (ok)
+	printf("Shared file test: both opens see all the data\n");
+    fileSystem->Remove(SharedFileName);
+    delete [] buffer;
+}
@@ -5,7 +5,30 @@
 //	the OpenFile data structure).
 //
 //	Also as in UNIX, for convenience, we keep the file header in
-//	memory while the file is open.
+//	memory while the file is open, in an inode shared by every open
+//	of the file.  Along with it, we keep the translation of every
+//	sector of the file to its disk sector, so that reads and writes
+//	do not have to look at the chain of pointer blocks of the header.
+//	Inodes stay in memory for a while after the file is closed, so
+//	that opening it again does not have to read the header.
+//
+//	With delayed allocation, data written past the last sector the
+//	file has is kept in memory, in the inode, where every open of the
+//	file sees it, and sectors are chosen for all of it at once, in a
+//	single run, when it is flushed -- when the file is closed, when
+//	too much of it has piled up, or when asked to.
+//
+//	The data of an inline file (cf. filehdr.h) is read from and
+//	written to its header, in the inode.  The holes of a sparse file
+//	read as zeros without going to disk, and the sectors of a hole
+//	are allocated, in runs, the first time they are written.
+//
+//	Small writes to a file can be combined: a sector being written
+//	a few bytes at a time is kept in memory, and written to disk
+//	only once the writer moves on to another sector (or seeks, or
+//	closes the file, or flushes it).  Every open file is kept on a
+//	list, so that before a sector is read or written, whoever else
+//	has a copy of it can write it back and drop it.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -16,29 +39,314 @@
 #include "openfile.h"
 #include "system.h"
 
+#include "synch.h"
+
+static OpenFile *openFiles = NULL;	// Every file open, for Synchronize
+static Lock *tableLock = NULL;		// Protects openFiles and the inodes
+
+// The inodes in memory, by the sector of their header
+#define NumInodeBuckets		31
+static Inode *inodes[NumInodeBuckets];
+static int numInodes = 0;
+
+//----------------------------------------------------------------------
+// Inode::Inode
+// 	Bring into memory the header of a file, and the translation of
+//	each sector of the file to its disk sector.
+//
+//	"hdrSector" -- the location on disk of the file header
+//----------------------------------------------------------------------
+
+Inode::Inode(int hdrSector)
+{
+    sector = hdrSector;
+    hdr = new FileHeader;
+    hdr->FetchFrom(sector);
+    hdrDirty = false;
+    blockMap = NULL;
+    mapSize = mapCapacity = 0;
+    UpdateBlockMap();
+    lock = new RWLock("file");
+    pending = NULL;
+    pendingStart = pendingLength = 0;
+    refCount = 0;
+    removed = false;
+    next = NULL;
+}
+
+//----------------------------------------------------------------------
+// Inode::~Inode
+// 	Write back the header, if need be, and de-allocate the inode.
+//----------------------------------------------------------------------
+
+Inode::~Inode()
+{
+    FlushHeader();
+    delete hdr;
+    delete [] blockMap;
+    delete [] pending;
+    delete lock;
+}
+
+//----------------------------------------------------------------------
+// Inode::UpdateBlockMap
+// 	Make the in-memory block map cover every sector of the file.
+//	Called when the file is opened, and whenever it grows; the map
+//	doubles in size as needed, so a growing file is re-translated
+//	only a logarithmic number of times.
+//----------------------------------------------------------------------
+
+void
+Inode::UpdateBlockMap()
+{
+    int numSectors = hdr->NumDataSectors();
+
+    if (numSectors == mapSize)
+	return;
+    if (numSectors > mapCapacity) {
+	delete [] blockMap;
+	mapCapacity = (2 * mapCapacity > numSectors) ? 2 * mapCapacity
+						     : numSectors;
+	blockMap = new int[mapCapacity];
+    }
+    if (numSectors > 0)
+	hdr->GetBlockMap(blockMap);
+    mapSize = numSectors;
+}
+
+//----------------------------------------------------------------------
+// Inode::FlushHeader
+// 	Write the file header back to disk, if only the copy in memory
+//	has the latest length of the file.  Once the file is removed,
+//	its header sector is no longer ours to write.
+//----------------------------------------------------------------------
+
+void
+Inode::FlushHeader()
+{
+    if (!hdrDirty || removed)
+	return;
+    hdr->WriteBack(sector);
+    hdrDirty = false;
+}
+
+//----------------------------------------------------------------------
+// Inode::Trim
+// 	Give back the sectors the file was given in advance, past its
+//	end, now that no one has it open; otherwise they would stay in
+//	use for as long as the file exists.  The free map and the header
+//	are changed in the same journal operation.  The file must be
+//	locked for writing.
+//----------------------------------------------------------------------
+
+void
+Inode::Trim()
+{
+    if (removed || hdr->NumDataSectors()
+			<= divRoundUp(hdr->FileLength(), SectorSize))
+	return;
+    synchDisk->BeginOperation();
+    if (hdr->Trim()) {
+	hdr->WriteBack(sector);
+	hdrDirty = false;
+	UpdateBlockMap();
+    }
+    synchDisk->EndOperation();
+}
+
+//----------------------------------------------------------------------
+// LockTable
+// 	Get exclusive use of the inode table and of the list of open
+//	files.  The lock is created the first time it is needed, since
+//	files are opened before anything else in the file system is
+//	set up.
+//----------------------------------------------------------------------
+
+static void
+LockTable()
+{
+    if (tableLock == NULL)
+	tableLock = new Lock("inode table");
+    tableLock->Acquire();
+}
+
+//----------------------------------------------------------------------
+// GetInode
+// 	Return the inode of the file whose header is at "sector",
+//	bringing it into memory if it is not there yet, and count one
+//	more user of it.  To make room, an inode nobody uses is dropped.
+//	The table must be locked.
+//----------------------------------------------------------------------
+
+static Inode *
+GetInode(int sector)
+{
+    Inode **bucket = &inodes[sector % NumInodeBuckets];
+    Inode *inode, **ptr;
+
+    for (inode = *bucket; inode != NULL; inode = inode->next)
+	if (inode->sector == sector)
+	    break;
+    if (inode == NULL) {
+	for (int i = 0; i < NumInodeBuckets && numInodes >= MaxInodes; i++)
+	    for (ptr = &inodes[i]; *ptr != NULL; )
+		if ((*ptr)->refCount == 0) {
+		    inode = *ptr;
+		    *ptr = inode->next;
+		    delete inode;
+		    numInodes--;
+		    break;
+		} else
+		    ptr = &(*ptr)->next;
+	inode = new Inode(sector);
+	inode->next = *bucket;
+	*bucket = inode;
+	numInodes++;
+    }
+    inode->refCount++;
+    return inode;
+}
+
+//----------------------------------------------------------------------
+// PutInode
+// 	One user less of "inode".  Its header is written back once no
+//	one uses it; the inode itself stays in memory, unless the file
+//	has been removed.  The table must be locked.
+//----------------------------------------------------------------------
+
+static void
+PutInode(Inode *inode)
+{
+    if (--inode->refCount > 0)
+	return;
+    if (inode->removed)
+	delete inode;
+    else
+	inode->FlushHeader();
+}
+
+//----------------------------------------------------------------------
+// ForgetInode
+// 	Take out of the table the inode of a file that is being removed,
+//	after writing back its header, so that the file system reads
+//	the latest version of it.  If the file is still open, the inode
+//	stays around until it is closed, but nothing more is read from
+//	or written to the file: its sectors are about to be freed, and
+//	may be given to another file.
+//
+//	The inode is marked removed with the file locked for writing,
+//	so that no read or write of it is under way once its sectors
+//	are freed.  The table is not kept locked meanwhile (cf.
+//	Synchronize); the inode is counted as used instead.
+//
+//	"sector" -- the location on disk of the header of the file
+//----------------------------------------------------------------------
+
+void
+ForgetInode(int sector)
+{
+    Inode **ptr = &inodes[sector % NumInodeBuckets];
+    Inode *inode = NULL;
+
+    LockTable();
+    while (*ptr != NULL && (*ptr)->sector != sector)
+	ptr = &(*ptr)->next;
+    if (*ptr != NULL) {
+	inode = *ptr;
+	*ptr = inode->next;
+	numInodes--;
+	inode->refCount++;
+    }
+    tableLock->Release();
+    if (inode == NULL)
+	return;
+    inode->lock->AcquireWrite();
+    inode->FlushHeader();
+    inode->removed = true;
+    inode->lock->ReleaseWrite();
+    LockTable();
+    PutInode(inode);
+    tableLock->Release();
+}
+
+//----------------------------------------------------------------------
+// FlushOpenFiles
+// 	Write to disk whatever data and headers the files that are still
+//	open keep only in memory -- the sector kept by write combining,
+//	the data waiting for delayed allocation, and the latest length
+//	-- because the disk is being shut down with them open.
+//
+//	The list of open files is walked without locking the table,
+//	since flushing a file locks it (cf. Synchronize); this is only
+//	called as the machine halts, when no other thread runs again.
+//----------------------------------------------------------------------
+
+void
+FlushOpenFiles()
+{
+    for (OpenFile *f = openFiles; f != NULL; f = f->nextOpen)
+	(void) f->Flush();
+}
+
 //----------------------------------------------------------------------
 // OpenFile::OpenFile
-// 	Open a Nachos file for reading and writing.  Bring the file header
-//	into memory while the file is open.
+// 	Open a Nachos file for reading and writing.  The file header is
+//	in memory while the file is open (and is brought in, if no one
+//	else has the file open).
 //
 //	"sector" -- the location on disk of the file header for this file
 //----------------------------------------------------------------------
 
 OpenFile::OpenFile(int sector)
 { 
-    hdr = new FileHeader;
-    hdr->FetchFrom(sector);
+    LockTable();
+    inode = GetInode(sector);
+    nextOpen = openFiles;
+    openFiles = this;
+    tableLock->Release();
+    hdr = inode->hdr;
+    hdrSector = sector;
     seekPosition = 0;
+    nextReadPosition = 0;
+    readAheadWindow = 0;
+    readAheadNext = 0;
+    delayed = false;
+    logged = false;
+    combine = false;
+    sectorBuf = NULL;
+    bufSector = -1;
+    bufDirty = false;
 }
 
 //----------------------------------------------------------------------
 // OpenFile::~OpenFile
 // 	Close a Nachos file, de-allocating any in-memory data structures.
+//	The last to close a file gives back the sectors past its end
+//	(see Inode::Trim), without the table locked: freeing them writes
+//	the free map, which locks it.
 //----------------------------------------------------------------------
 
 OpenFile::~OpenFile()
 {
-    delete hdr;
+    OpenFile **ptr = &openFiles;
+    bool last;
+
+    Flush();
+    LockTable();
+    while (*ptr != this)
+	ptr = &(*ptr)->nextOpen;
+    *ptr = nextOpen;
+    last = (inode->refCount == 1);
+    if (last) {
+	tableLock->Release();		// still counted as a user
+	inode->lock->AcquireWrite();
+	inode->Trim();
+	inode->lock->ReleaseWrite();
+	LockTable();
+    }
+    PutInode(inode);
+    tableLock->Release();
+    delete [] sectorBuf;
 }
 
 //----------------------------------------------------------------------
@@ -52,6 +360,11 @@ OpenFile::~OpenFile()
 void
 OpenFile::Seek(int position)
 {
+    if (bufDirty) {
+	inode->lock->AcquireWrite();
+	FlushBuffer();
+	inode->lock->ReleaseWrite();
+    }
     seekPosition = position;
 }	
 
@@ -72,6 +385,7 @@ int
 OpenFile::Read(char *into, int numBytes)
 {
    int result = ReadAt(into, numBytes, seekPosition);
+   ReadAhead(seekPosition, result);
    seekPosition += result;
    return result;
 }
@@ -84,24 +398,90 @@ OpenFile::Write(const char *into, int numBytes)
    return result;
 }
 
+//----------------------------------------------------------------------
+// OpenFile::ReadAhead
+// 	Keep track of the access pattern of Read, and if it is
+//	sequential, ask the disk to start reading the sectors the
+//	caller is going to need next, so that the transfers overlap
+//	with whatever the caller does in the meantime.
+//
+//	A Read that starts where the previous one ended is sequential;
+//	every time a sequential reader moves on to a new sector, the
+//	read-ahead window doubles (up to MaxReadAhead sectors).  Any
+//	other Read is random, and stops read-ahead until the reader
+//	becomes sequential again.
+//
+//	"position" -- where the Read that just finished started
+//	"numBytes" -- the number of bytes it read
+//----------------------------------------------------------------------
+
+void
+OpenFile::ReadAhead(int position, int numBytes)
+{
+    int firstSector, lastSector, endSector, i;
+
+    if (numBytes <= 0)
+	return;
+    firstSector = divRoundDown(position, SectorSize);
+    lastSector = divRoundDown(position + numBytes - 1, SectorSize);
+    if (position != nextReadPosition) {		// random access
+	readAheadWindow = 0;
+	readAheadNext = lastSector + 1;
+    } else if (readAheadWindow == 0)
+	readAheadWindow = MinReadAhead;
+    else if (lastSector > divRoundDown(position - 1, SectorSize)
+	     && readAheadWindow < MaxReadAhead)
+	readAheadWindow *= 2;
+    nextReadPosition = position + numBytes;
+
+    if (readAheadWindow == 0)
+	return;
+    if (readAheadNext <= lastSector)
+	readAheadNext = lastSector + 1;
+    endSector = lastSector + readAheadWindow;
+    inode->lock->AcquireRead();		// the file may be growing
+    if (inode->removed)
+	endSector = -1;			// its sectors may be reused
+    if (endSector > divRoundUp(hdr->FileLength(), SectorSize) - 1)
+	endSector = divRoundUp(hdr->FileLength(), SectorSize) - 1;
+    if (endSector > inode->mapSize - 1)
+	endSector = inode->mapSize - 1;
+    for (i = readAheadNext; i <= endSector; i++)
+	if (inode->blockMap[i] != -1)		// nothing to read in a hole
+	    synchDisk->Prefetch(inode->blockMap[i]);
+    inode->lock->ReleaseRead();
+    if (endSector >= readAheadNext)
+	readAheadNext = endSector + 1;
+    DEBUG('f', "Read ahead of sector %d, window %d.\n", firstSector,
+							readAheadWindow);
+}
+
 //----------------------------------------------------------------------
 // OpenFile::ReadAt/WriteAt
 // 	Read/write a portion of a file, starting at "position".
 //	Return the number of bytes actually written or read, but has
 //	no side effects (except that Write modifies the file, of course).
+//	Once the file has been removed, nothing is read (as at the end
+//	of the file), and WriteAt returns -1.
 //
 //	There is no guarantee the request starts or ends on an even disk sector
 //	boundary; however the disk only knows how to read/write a whole disk
-//	sector at a time.  Thus:
+//	sector at a time.  Sectors entirely covered by the request are
+//	transferred straight to or from the caller's buffer; a partial
+//	sector at either end goes through the thread's bounce buffer:
 //
 //	For ReadAt:
-//	   We read in all of the full or partial sectors that are part of the
-//	   request, but we only copy the part we are interested in.
+//	   We read in each partial sector that is part of the request,
+//	   but we only copy the part we are interested in.
 //	For WriteAt:
 //	   We must first read in any sectors that will be partially written,
 //	   so that we don't overwrite the unmodified portion.  We then copy
 //	   in the data that will be modified, and write back all the full
 //	   or partial sectors that are part of the request.
+//	   Only a write past the end of the file makes it longer; the
+//	   new sectors are allocated before anything is written, except
+//	   those of the gap, if the write starts past the end, which are
+//	   left as a hole.
 //
 //	"into" -- the buffer to contain the data to be read from disk 
 //	"from" -- the buffer containing the data to be written to disk 
@@ -113,13 +493,18 @@ OpenFile::Write(const char *into, int numBytes)
 int
 OpenFile::ReadAt(char *into, int numBytes, int position)
 {
-    int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
-    char *buf;
+    int fileLength;
+    int i, firstSector, lastSector, start, end;
+    char *bounce = currentThread->BounceBuffer();
 
-	//fileLock->Acquire();
-    if ((numBytes <= 0) || (position >= fileLength))
+    if (numBytes <= 0)
+	return 0;
+    inode->lock->AcquireRead();
+    fileLength = Length();
+    if (position >= fileLength || inode->removed) {
+	inode->lock->ReleaseRead();
     	return 0; 				// check request
+    }
     if ((position + numBytes) > fileLength)		
 	numBytes = fileLength - position;
     DEBUG('f', "Reading %d bytes at %d, from file of length %d.\n", 	
@@ -127,70 +512,289 @@ OpenFile::ReadAt(char *into, int numBytes, int position)
 
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
-    numSectors = 1 + lastSector - firstSector;
 
-    // read in all the full and partial sectors that we need
-    buf = new char[numSectors * SectorSize];
-    for (i = firstSector; i <= lastSector; i++)	
-        synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize), 
-					&buf[(i - firstSector) * SectorSize]);
-
-    // copy the part we want
-    bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
-    delete [] buf;
-	//fileLock->Release();
+    for (i = firstSector; i <= lastSector; i++) {
+	start = (i == firstSector) ? position : i * SectorSize;
+	end = (i == lastSector) ? position + numBytes : (i + 1) * SectorSize;
+	if (end - start == SectorSize)		// the whole sector
+	    FetchSector(i, &into[start - position]);
+	else {					// copy the part we want
+	    FetchSector(i, bounce);
+	    bcopy(&bounce[start - i * SectorSize], &into[start - position],
+							end - start);
+	}
+    }
+    inode->lock->ReleaseRead();
     return numBytes;
+}
+
+int
+OpenFile::WriteAt(const char *from, int numBytes, int position)
+{
+    int result;
 
+    if ((numBytes <= 0) || (position < 0))
+	return 0;				// check request
+    inode->lock->AcquireWrite();
+    if (inode->removed)
+	result = -1;				// the file is gone
+    else
+	result = Store(from, numBytes, position);
+    inode->lock->ReleaseWrite();
+    return result;
 }
 
+//----------------------------------------------------------------------
+// OpenFile::Store
+// 	Do the work of WriteAt, with the file locked for writing: write
+//	the data through to disk, or keep in memory the part of it that
+//	can wait for delayed allocation.  Return the number of bytes
+//	written, or -1 if the disk is full.
+//
+//	Before a write through makes the file grow, the data any open of
+//	the file keeps for delayed allocation is flushed: it lies right
+//	after the allocated sectors, where the new ones would go.
+//----------------------------------------------------------------------
+
 int
-OpenFile::WriteAt(const char *from, int numBytes, int position){
+OpenFile::Store(const char *from, int numBytes, int position)
+{
+    int allocated = hdr->NumDataSectors() * SectorSize;
+    int head, result;
 
-    if(hdr->AddLength(numBytes)){		// se agrega esta linea para que los archivos sean de tamano variable
-		int fileLength = hdr->FileLength();
-		int i, firstSector, lastSector, numSectors;
-		bool firstAligned, lastAligned;
-		char *buf;
-		
-		//fileLock->Acquire();
+    if (position + numBytes <= allocated)
+	return WriteThrough(from, numBytes, position);
+    if (!delayed || hdr->IsInline()) {
+	if (!FlushDelayed())
+	    return -1;				// disk full
+	return WriteThrough(from, numBytes, position);
+    }
+    if (!ZeroGap(position))
+	return -1;
 
-		if ((numBytes <= 0) || (position >= fileLength))
-		return 0;				// check request
-		
-		firstSector = divRoundDown(position, SectorSize);
-		lastSector = divRoundDown(position + numBytes - 1, SectorSize);
-		numSectors = 1 + lastSector - firstSector;
+    // the part that falls in allocated sectors goes to disk; the rest
+    // waits in memory, if there is room
+    head = (position < allocated) ? allocated - position : 0;
+    if (head > 0 && WriteThrough(from, head, position) != head)
+	return -1;
+    if (!Delay(from + head, numBytes - head, position + head)) {
+	if (inode->pendingLength == 0)		// too much to keep at all
+	    result = WriteThrough(from + head, numBytes - head,
+							position + head);
+	else if (Sync())			// make room, and start over
+	    result = Store(from + head, numBytes - head, position + head);
+	else
+	    result = -1;			// disk full
+	if (result < 0)
+	    return -1;
+    }
+    return numBytes;
+}
 
-		buf = new char[numSectors * SectorSize];
+//----------------------------------------------------------------------
+// OpenFile::WriteThrough
+// 	Do the work of WriteAt, writing the data to disk right away, and
+//	making the file longer first if need be.  Return the number of
+//	bytes written, or -1 if the disk is full.
+//
+//	If writes are combined, a write to part of a single sector only
+//	goes as far as sectorBuf, and a new length that needs no new
+//	sectors is only written to the header on disk at Flush.  So is
+//	the data of an inline file, which is part of the header.
+//
+//	Sectors of a hole that are written are allocated first; those
+//	written only in part start out as zeros, not as whatever their
+//	new disk sector held.  So do sectors past the old end of the
+//	file, which hold no data yet even if they were given to the file
+//	in advance: they are not read first.  The header, with the new
+//	pointers, is written back once the data is on disk.  A gap
+//	between the end of the file and "position" becomes a hole (cf.
+//	ZeroGap).
+//----------------------------------------------------------------------
 
-		firstAligned = (position == (firstSector * SectorSize));
-		lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
+int
+OpenFile::WriteThrough(const char *from, int numBytes, int position)
+{
+    int fileLength, oldLength;
+    int i, firstSector, lastSector, numSectors, start, end, count;
+    bool firstAligned, lastAligned, firstFresh, lastFresh;
+    char *bounce = currentThread->BounceBuffer();
 
-	// read in first and last sector, if they are to be partially modified
-		if (!firstAligned)
-		    ReadAt(buf, SectorSize, firstSector * SectorSize);	
-		if (!lastAligned && ((firstSector != lastSector) || firstAligned))
-		    ReadAt(&buf[(lastSector - firstSector) * SectorSize], 
-					SectorSize, lastSector * SectorSize);	
+    if (!ZeroGap(position))
+	return -1;				// disk full
+    fileLength = oldLength = hdr->FileLength();
+    if (position + numBytes > fileLength) {	// writing past the end
+	if ((position > fileLength && !hdr->AddHole(position - fileLength))
+		|| !hdr->AddLength(position + numBytes - hdr->FileLength())) {
+	    hdr->WriteBack(hdrSector);		// its format may have changed
+	    inode->UpdateBlockMap();
+	    return -1;				// disk full
+	}
+	if (combine && hdr->NumDataSectors() == inode->mapSize)
+	    inode->hdrDirty = true;		// only the length changed
+	else
+	    hdr->WriteBack(hdrSector);
+	inode->UpdateBlockMap();
+	fileLength = hdr->FileLength();
+    }
+    DEBUG('f', "Writing %d bytes at %d, to file of length %d.\n", 	
+			numBytes, position, fileLength);
 
-	// copy in the bytes we want to change 
-		bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
+    if (hdr->IsInline()) {
+	hdr->WriteInline(from, numBytes, position);
+	if (combine)
+	    inode->hdrDirty = true;
+	else
+	    hdr->WriteBack(hdrSector);
+	return numBytes;
+    }
+		
+    firstSector = divRoundDown(position, SectorSize);
+    lastSector = divRoundDown(position + numBytes - 1, SectorSize);
+    numSectors = 1 + lastSector - firstSector;
 
-	// write modified sectors back
+    firstAligned = (position == (firstSector * SectorSize));
+    lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
+    firstFresh = (firstSector * SectorSize >= oldLength);
+    lastFresh = (lastSector * SectorSize >= oldLength);
 
-		for (i = firstSector; i <= lastSector; i++)	
-		    synchDisk->WriteSector(hdr->ByteToSector(i * SectorSize), 
-						&buf[(i - firstSector) * SectorSize]);
-		delete [] buf;
-	
-		//fileLock->Release();
-    }else{
-    	numBytes = -1;
+    for (i = firstSector; i <= lastSector; i += count) {
+	for (count = 0; i + count <= lastSector
+			&& inode->blockMap[i + count] == -1; count++)
+	    ;
+	if (count == 0) {
+	    count = 1;				// not in a hole
+	    continue;
+	}
+	if (!hdr->FillHole(i, count, &inode->blockMap[i])) {
+	    inode->FlushHeader();
+	    return -1;				// disk full
+	}
+	inode->hdrDirty = true;
+	firstFresh = firstFresh || (i == firstSector);
+	lastFresh = lastFresh || (i + count - 1 == lastSector);
     }
 
+    if (combine && numSectors == 1 && !(firstAligned && lastAligned)) {
+	if (bufSector != firstSector) {		// moving on to another sector
+	    FlushBuffer();
+	    Synchronize(firstSector);
+	    if (firstFresh)
+		bzero(sectorBuf, SectorSize);
+	    else
+		synchDisk->ReadSector(inode->blockMap[firstSector], sectorBuf);
+	    bufSector = firstSector;
+	}
+	bcopy(from, &sectorBuf[position - (firstSector * SectorSize)],
+								numBytes);
+	bufDirty = true;
+	return numBytes;
+    }
+    if (bufSector >= firstSector && bufSector <= lastSector) {
+	FlushBuffer();				// about to be overwritten
+	bufSector = -1;
+    }
+    for (i = firstSector; i <= lastSector; i++) {
+	start = (i == firstSector) ? position : i * SectorSize;
+	end = (i == lastSector) ? position + numBytes : (i + 1) * SectorSize;
+	if (end - start == SectorSize) {	// the whole sector
+	    Synchronize(i);
+	    if (logged)
+		synchDisk->LogSector(inode->blockMap[i],
+						&from[start - position]);
+	    else
+		synchDisk->WriteSector(inode->blockMap[i],
+						&from[start - position]);
+	} else {				// read in the rest of it
+	    if ((i == firstSector && firstFresh)
+				|| (i == lastSector && lastFresh))
+		bzero(bounce, SectorSize);
+	    else
+		FetchSector(i, bounce);
+	    bcopy(&from[start - position], &bounce[start - i * SectorSize],
+							end - start);
+	    if (logged)
+		synchDisk->LogSector(inode->blockMap[i], bounce);
+	    else
+		synchDisk->WriteSector(inode->blockMap[i], bounce);
+	}
+    }
+    if (!combine)
+	inode->FlushHeader();			// the pointers to filled holes
     return numBytes;
 }
 
+//----------------------------------------------------------------------
+// OpenFile::ZeroGap
+// 	Before a write at "position", past the end of the file, fill
+//	with zeros the part of the gap that lies in sectors the file
+//	already has (those given to it in advance by AddLength): unlike
+//	a hole, they hold whatever was on disk.  Return false if the
+//	disk is full.
+//----------------------------------------------------------------------
+
+bool
+OpenFile::ZeroGap(int position)
+{
+    char *zeros;
+    int fileLength = hdr->FileLength();
+    int end = hdr->NumDataSectors() * SectorSize;
+    int count;
+    bool result = true;
+
+    if (position < end)
+	end = position;
+    if (fileLength >= end)
+	return true;				// no gap, or all of it a hole
+    zeros = new char[SectorSize];
+    bzero(zeros, SectorSize);
+    while (fileLength < end && result) {	// a sector at a time
+	count = SectorSize - fileLength % SectorSize;
+	if (count > end - fileLength)
+	    count = end - fileLength;
+	result = (WriteThrough(zeros, count, fileLength) == count);
+	fileLength = hdr->FileLength();
+    }
+    delete [] zeros;
+    return result;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::FetchSector
+// 	Read sector "sector" of the file into "into": from memory, if
+//	it is kept there by write combining or delayed allocation, or
+//	in the header of an inline file, or else from disk.  A sector
+//	in a hole is all zeros.
+//
+//	The bitmap and the directories, which are written through the
+//	journal, are read a track at a time (see SynchDisk::ReadTrack):
+//	their sectors were allocated together, and are read together.
+//	So is a file that has been read sequentially for a while (its
+//	read-ahead window is as large as it gets).
+//----------------------------------------------------------------------
+
+void
+OpenFile::FetchSector(int sector, char *into)
+{
+    if (hdr->IsInline())
+	hdr->ReadInline(into);
+    else if (sector == bufSector)
+	bcopy(sectorBuf, into, SectorSize);
+    else if (inode->pendingLength > 0
+		&& sector * SectorSize >= inode->pendingStart)
+	bcopy(&inode->pending[sector * SectorSize - inode->pendingStart],
+							into, SectorSize);
+    else if (inode->blockMap[sector] == -1)
+	bzero(into, SectorSize);
+    else {
+	Synchronize(sector);
+	if (logged || readAheadWindow == MaxReadAhead)
+	    synchDisk->ReadTrack(inode->blockMap[sector], into);
+	else
+	    synchDisk->ReadSector(inode->blockMap[sector], into);
+    }
+}
+
 //----------------------------------------------------------------------
 // OpenFile::Length
 // 	Return the number of bytes in the file.
@@ -199,5 +803,196 @@ OpenFile::WriteAt(const char *from, int numBytes, int position){
 int
 OpenFile::Length() 
 { 
+    if (inode->pendingLength > 0)
+	return inode->pendingStart + inode->pendingLength;
     return hdr->FileLength(); 
 }
+
+//----------------------------------------------------------------------
+// OpenFile::DelayAllocation
+// 	From now on, keep the data written past the last allocated sector
+//	of the file in memory, until it is flushed.
+//----------------------------------------------------------------------
+
+void
+OpenFile::DelayAllocation()
+{
+    delayed = true;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Delay
+// 	Keep in memory data written at or past the end of the last
+//	allocated sector of the file.  Any gap between the end of the
+//	file and "position" reads as zeros.  Return false if it would
+//	take more than MaxDelayedSectors sectors to hold the data.
+//
+//	The data is kept in the inode, along with what other opens of
+//	the file have written there, so they all read it (cf.
+//	FetchSector and Length), and none of them writes the others'
+//	data back with its own.
+//
+//	"from" -- the buffer containing the data
+//	"numBytes" -- the number of bytes to keep
+//	"position" -- the offset within the file of the first byte
+//----------------------------------------------------------------------
+
+bool
+OpenFile::Delay(const char *from, int numBytes, int position)
+{
+    int allocated = hdr->NumDataSectors() * SectorSize;
+    int end = position + numBytes - allocated;
+
+    if (end > MaxDelayedSectors * SectorSize || position < allocated)
+	return false;
+    if (inode->pending == NULL)
+	inode->pending = new char[MaxDelayedSectors * SectorSize];
+    if (inode->pendingLength == 0)
+	inode->pendingStart = allocated;
+    ASSERT(inode->pendingStart == allocated);
+    if (end > inode->pendingLength) {
+	bzero(&inode->pending[inode->pendingLength],
+					end - inode->pendingLength);
+	inode->pendingLength = end;
+    }
+    bcopy(from, &inode->pending[position - allocated], numBytes);
+    return true;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::LogWrites
+// 	From now on, write the file through the journal.  Used for the
+//	files holding the metadata of the file system -- the bitmap and
+//	the directories -- whose changes must reach the disk together
+//	with those of the file headers.
+//----------------------------------------------------------------------
+
+void
+OpenFile::LogWrites()
+{
+    logged = true;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::CombineWrites
+// 	From now on, keep in memory the sector being written a bit at a
+//	time, until the writer is done with it.
+//----------------------------------------------------------------------
+
+void
+OpenFile::CombineWrites()
+{
+    combine = true;
+    if (sectorBuf == NULL)
+	sectorBuf = new char[SectorSize];
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Flush/Sync
+// 	Write to disk whatever data written to the file is still only
+//	in memory.  Return false if some of it was lost because the disk
+//	is full.  Sync does the work, once the file is locked for
+//	writing.
+//----------------------------------------------------------------------
+
+bool
+OpenFile::Flush()
+{
+    bool result;
+
+    inode->lock->AcquireWrite();
+    result = Sync();
+    inode->lock->ReleaseWrite();
+    return result;
+}
+
+bool
+OpenFile::Sync()
+{
+    FlushBuffer();
+    inode->FlushHeader();
+    return FlushDelayed();
+}
+
+//----------------------------------------------------------------------
+// OpenFile::FlushBuffer
+// 	Write the sector kept by write combining back to disk, if it
+//	has changed.  The copy in memory stays valid.
+//----------------------------------------------------------------------
+
+void
+OpenFile::FlushBuffer()
+{
+    if (bufSector == -1 || !bufDirty || inode->removed)
+	return;
+    synchDisk->WriteSector(inode->blockMap[bufSector], sectorBuf);
+    bufDirty = false;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Synchronize
+// 	Make sure that no other open of the same file keeps its own copy
+//	of a sector: if one does, it writes it back, if need be, and
+//	forgets it, so that the disk has the latest data for the sector.
+//	Called before reading or writing the sector on disk.
+//
+//	"sector" -- the sector of the file (not of the disk)
+//----------------------------------------------------------------------
+
+void
+OpenFile::Synchronize(int sector)
+{
+    LockTable();
+    for (OpenFile *f = openFiles; f != NULL; f = f->nextOpen)
+	if (f != this && f->hdrSector == hdrSector
+		      && f->bufSector == sector) {
+	    f->FlushBuffer();
+	    f->bufSector = -1;
+	}
+    tableLock->Release();
+}
+
+//----------------------------------------------------------------------
+// OpenFile::FlushDelayed
+// 	Write to disk the data kept in memory by delayed allocation,
+//	by this open of the file or any other.  All the sectors it needs
+//	are allocated together, so they can be given to the file in one
+//	run.  No one else can have given the file sectors meanwhile,
+//	since a write that makes it grow flushes the data first (cf.
+//	Store).
+//
+//	The free map is written back as the sectors are allocated, then
+//	the data goes to disk, and only then the header, so that the
+//	header on disk never points at a sector that is free, or that
+//	does not hold the file's data yet.
+//
+//	Return false, dropping the data, if there is not enough space on
+//	disk for it.
+//----------------------------------------------------------------------
+
+bool
+OpenFile::FlushDelayed()
+{
+    int first, count, i, length = inode->pendingLength;
+    char *pending = inode->pending;
+
+    if (length == 0 || inode->removed) {
+	inode->pendingLength = 0;
+	return !inode->removed;
+    }
+    inode->pendingLength = 0;
+    ASSERT(hdr->NumDataSectors() * SectorSize == inode->pendingStart);
+    first = inode->pendingStart / SectorSize;
+    count = divRoundUp(length, SectorSize);
+    bzero(&pending[length], count * SectorSize - length);
+    if (!hdr->AddLength(inode->pendingStart + length - hdr->FileLength()))
+	return false;				// disk full
+    inode->UpdateBlockMap();
+    for (i = 0; i < count; i++)
+	synchDisk->WriteSector(inode->blockMap[first + i],
+						&pending[i * SectorSize]);
+    hdr->WriteBack(hdrSector);
+    inode->hdrDirty = false;
+    DEBUG('f', "Flushed %d delayed sectors at sector %d.\n", count, first);
+    return true;
+}
@@ -9,9 +9,9 @@
 //
 //	The other is the "real" implementation, that turns these
 //	operations into read and write disk sector requests. 
-//	In this baseline implementation of the file system, we don't 
-//	worry about concurrent accesses to the file system
-//	by different threads -- this is part of the assignment.
+//	Each file has a readers/writers lock: any number of threads can
+//	read it at the same time, while a thread writing it has it to
+//	itself.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -60,6 +60,65 @@ class OpenFile {
 
 #else // FILESYS
 class FileHeader;
+class RWLock;
+
+// The following class defines an in-memory "inode": what the kernel
+// knows about a file that is open.  There is a single one for each
+// file, however many times it is open, so that they all see the same
+// header; it is found by the sector of the file header, and it is
+// kept after the file is closed (until it is needed for another
+// file), so that opening the file again needs no disk I/O.
+//
+// Internal data structures kept public so that OpenFile can access
+// them directly.
+
+// Number of inodes kept in memory, unless more files are open.
+#define MaxInodes	32
+
+class Inode {
+  public:
+    Inode(int hdrSector);		// Bring a file header into memory
+    ~Inode();
+
+    void UpdateBlockMap();		// Resynchronize blockMap with hdr
+    void FlushHeader();			// Write hdr, if it changed
+    void Trim();			// Free the sectors past the end
+
+    int sector;				// Where the header is on disk
+    FileHeader *hdr;			// The header of the file
+    bool hdrDirty;			// Has hdr (its length, or the pointers
+					// to filled holes) changed since it
+					// was written back?
+    int *blockMap;			// Disk sector of each sector of the
+					// file, so no lookup needs disk I/O
+    int mapSize;			// # entries in blockMap
+    int mapCapacity;			// # entries allocated for blockMap
+    RWLock *lock;			// Held for reading to read the file,
+					// and for writing to change it
+    char *pending;			// Data appended with delayed allocation,
+    int pendingStart;			// not yet on disk, of the file from
+					// this offset (the end of its last
+					// allocated sector)
+    int pendingLength;			// for this many bytes
+    int refCount;			// # OpenFiles using the inode
+    bool removed;			// Has the file been removed?
+    Inode *next;			// Next inode in the same bucket
+};
+
+extern void ForgetInode(int sector);	// The file whose header is at
+					// "sector" is being removed
+extern void FlushOpenFiles();		// Write to disk what every open
+					// file keeps in memory
+
+// Bounds on how many sectors to read ahead of a sequential reader.
+// The window starts small and doubles each time the reader moves on
+// to the next sector, up to the maximum.
+#define MinReadAhead	2
+#define MaxReadAhead	16
+
+// Most data appended to a file with delayed allocation that is kept in
+// memory before it is flushed to disk.
+#define MaxDelayedSectors	32
 
 class OpenFile {
   public:
@@ -87,9 +146,58 @@ class OpenFile {
 					// than the UNIX idiom -- lseek to 
 					// end of file, tell, lseek back 
     
+    void DelayAllocation();		// Keep appended data in memory, and
+					// only choose its sectors at Flush
+    void CombineWrites();		// Gather small writes to a sector in
+					// memory, and write it once
+    void LogWrites();			// Write the file through the journal
+					// (it holds metadata)
+    bool Flush();			// Write buffered and delayed data
+					// to disk
+    
   private:
-    FileHeader *hdr;			// Header for this file 
+    Inode *inode;			// Shared with other opens of the file
+    FileHeader *hdr;			// Header for this file (inode->hdr)
+    int hdrSector;			// Where the header is on disk
     int seekPosition;			// Current position within the file
+
+    int nextReadPosition;		// Where a sequential Read would start
+    int readAheadWindow;		// # sectors to stay ahead of the
+					// reader; 0 after a random access
+    int readAheadNext;			// First sector not yet read ahead
+
+    void ReadAhead(int position, int numBytes);
+					// Detect sequential access, and
+					// prefetch the sectors that follow
+
+    bool delayed;			// Is allocation delayed?
+
+    bool logged;			// Is the file written through the
+					// journal?
+    bool combine;			// Are small writes combined?
+    char *sectorBuf;			// Contents of one sector of the file,
+    int bufSector;			// this one (or -1 if none), with
+    bool bufDirty;			// changes not yet written to disk?
+
+    OpenFile *nextOpen;			// Next in the list of open files
+    friend void FlushOpenFiles();
+
+    void FetchSector(int sector, char *into);
+					// Read a whole sector of the file
+    int WriteThrough(const char *from, int numBytes, int position);
+					// Write to disk right away
+    bool ZeroGap(int position);		// Clear the allocated part of the
+					// gap before a write past the end
+    bool Delay(const char *from, int numBytes, int position);
+					// Keep appended data in memory
+    int Store(const char *from, int numBytes, int position);
+					// Write, delaying what can be
+    bool Sync();			// Flush, with the lock held
+    bool FlushDelayed();		// Allocate and write delayed data
+    void FlushBuffer();			// Write sectorBuf, if it changed
+    void Synchronize(int sector);	// Make other opens of the file write
+					// back and forget their copy of
+					// "sector"
 };
 
 #endif // FILESYS
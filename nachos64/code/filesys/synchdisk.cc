@@ -5,10 +5,44 @@
 //	the disk providing a synchronous interface (requests wait until
 //	the request completes).
 //
-//	Use a semaphore to synchronize the interrupt handlers with the
-//	pending requests.  And, because the physical disk can only
-//	handle one operation at a time, use a lock to enforce mutual
-//	exclusion.
+//	Because the physical disk can only handle one operation at a
+//	time, requests are put on a queue of pending requests, and the
+//	disk interrupt handler starts the next one when the current one
+//	finishes.  A thread that needs the result of a request waits on
+//	a semaphore, which the interrupt handler signals.  The queue is
+//	shared with the interrupt handler, so it is only touched with
+//	interrupts disabled.
+//
+//	The order in which pending requests are served is set by a
+//	scheduling policy:
+//	   FIFO -- in order of arrival
+//	   C-LOOK -- the head sweeps towards higher tracks, serving the
+//	     nearest request ahead of it, and jumps back to the lowest
+//	     pending track when there is nothing left ahead; requests on
+//	     the same track are served in order of Disk::ComputeLatency,
+//	     so the rotational delay is kept short as well
+//	   Deadline -- C-LOOK, except that a request that has waited for
+//	     longer than DiskDeadline ticks is served first
+//
+//	Sectors are kept in a write-back buffer cache, so that the
+//	directory, the bitmap and the file headers, which are read over
+//	and over again, are served from memory.  The cache is a fixed
+//	array of entries, found by hashing the sector number, and
+//	replaced in least recently used order.  Dirty entries are only
+//	written to disk when they are replaced, or when the cache is
+//	flushed (Nachos flushes the cache when the machine halts).
+//	A lock protects the cache; it is not held while a thread waits
+//	for the disk, so hits can be served in the meantime.
+//
+//	Since a request does not have to be waited for, a sector can
+//	also be read ahead into the cache (Prefetch), overlapping the
+//	disk transfer with whatever the requesting thread does next.
+//
+//	Metadata sectors written through the journal (LogSector) stay
+//	out of the write-back cache until they are checkpointed, so they
+//	never reach their place on disk before the record holding them
+//	is in the log.  Until then, reads of them are served from the
+//	journal's own copies.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -16,6 +50,9 @@
 
 #include "copyright.h"
 #include "synchdisk.h"
+#include "system.h"
+
+const char *PolicyNames[] = { "FIFO", "C-LOOK", "deadline" };
 
 //----------------------------------------------------------------------
 // DiskRequestDone
@@ -38,13 +75,52 @@ DiskRequestDone (void* arg)
 //
 //	"name" -- UNIX file name to be used as storage for the disk data
 //	   (usually, "DISK")
+//	"numEntries" -- number of sectors to keep in the buffer cache
+//	"order" -- the policy that orders the pending requests
+//	"mapFile" -- should the UNIX file be mapped into memory?
 //----------------------------------------------------------------------
 
-SynchDisk::SynchDisk(const char* name)
+SynchDisk::SynchDisk(const char* name, int numEntries, DiskPolicy order,
+							bool mapFile)
 {
-    semaphore = new Semaphore("synch disk", 0);
     lock = new Lock("synch disk lock");
-    disk = new Disk(name, DiskRequestDone, this);
+    disk = new Disk(name, DiskRequestDone, this, mapFile);
+    halted = false;
+    journalLock = new Lock("journal lock");
+    journalSector = -1;
+    logged = NULL;
+    numLogged = numRunning = 0;
+    head = sequence = 0;
+    numOperations = 0;
+    active = NULL;
+    pending = NULL;
+    headSector = 0;
+    policy = order;
+    stats->diskPolicy = PolicyNames[policy];
+
+    cacheSize = numEntries;
+    numBuckets = cacheSize + 1;
+    cache = new CacheEntry[cacheSize];
+    hashTable = new CacheEntry *[numBuckets];
+    for (int i = 0; i < numBuckets; i++)
+	hashTable[i] = NULL;
+    lruFirst = lruLast = NULL;
+    for (int i = 0; i < cacheSize; i++) {
+	cache[i].sector = -1;
+	cache[i].dirty = false;
+	cache[i].busy = false;
+	cache[i].waiters = 0;
+	cache[i].ready = new Semaphore("cache entry", 0);
+	cache[i].data = new char[SectorSize];
+	cache[i].hashNext = NULL;
+	cache[i].prev = lruLast;	// build the LRU list in array order
+	cache[i].next = NULL;
+	if (lruLast != NULL)
+	    lruLast->next = &cache[i];
+	else
+	    lruFirst = &cache[i];
+	lruLast = &cache[i];
+    }
 }
 
 //----------------------------------------------------------------------
@@ -55,9 +131,16 @@ SynchDisk::SynchDisk(const char* name)
 
 SynchDisk::~SynchDisk()
 {
+    for (int i = 0; i < cacheSize; i++) {
+	delete [] cache[i].data;
+	delete cache[i].ready;
+    }
+    delete [] cache;
+    delete [] hashTable;
+    delete [] logged;
     delete disk;
+    delete journalLock;
     delete lock;
-    delete semaphore;
 }
 
 //----------------------------------------------------------------------
@@ -72,10 +155,57 @@ SynchDisk::~SynchDisk()
 void
 SynchDisk::ReadSector(int sectorNumber, char* data)
 {
-    lock->Acquire();			// only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P();			// wait for interrupt
+    (void) ReadCached(sectorNumber, data);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadCached
+// 	Do the work of ReadSector, and return whether the sector was
+//	found in memory.
+//
+//	If the sector is in the buffer cache, no disk request is needed;
+//	otherwise it is read into the least recently used cache entry.
+//	A sector that is still being read ahead counts as a hit; we
+//	only wait for the rest of the transfer.  So does a sector that
+//	was changed through the journal and is not yet checkpointed.
+//
+//	"sectorNumber" -- the disk sector to read
+//	"data" -- the buffer to hold the contents of the disk sector
+//----------------------------------------------------------------------
+
+bool
+SynchDisk::ReadCached(int sectorNumber, char* data)
+{
+    CacheEntry *entry;
+    LoggedSector *copy = NULL;
+    bool cached;
+
+    if (journalSector != -1) {
+	journalLock->Acquire();
+	copy = FindLogged(sectorNumber);
+	if (copy != NULL) {
+	    bcopy(copy->data, data, SectorSize);
+	    stats->numCacheHits++;
+	}
+	journalLock->Release();
+	if (copy != NULL)
+	    return true;
+    }
+    if (cacheSize == 0) {
+	Transfer(sectorNumber, data, false);
+	return false;
+    }
+    lock->Acquire();
+    cached = (Lookup(sectorNumber) != NULL);
+    if (cached)
+	stats->numCacheHits++;
+    else
+	stats->numCacheMisses++;
+    entry = GetEntry(sectorNumber, true);
+    bcopy(entry->data, data, SectorSize);
+    MakeRecent(entry);
     lock->Release();
+    return cached;
 }
 
 //----------------------------------------------------------------------
@@ -83,6 +213,18 @@ SynchDisk::ReadSector(int sectorNumber, char* data)
 // 	Write the contents of a buffer into a disk sector.  Return only
 //	after the data has been written.
 //
+//	The cache is write-back: the data is copied into the cache entry
+//	for the sector, which is marked dirty, and will reach the disk
+//	when it is replaced or flushed.  Since the whole sector is being
+//	written, there is no need to read the old contents on a miss.
+//
+//	If the journal still holds a copy of the sector (it was, say,
+//	a file header, and has been freed and reused for data), the
+//	journal is checkpointed first, so that the copy cannot overwrite
+//	the new contents when the log is replayed.  If the copy is in the
+//	running transaction, and an operation is under way so that it
+//	cannot be committed, the copy is dropped from it instead.
+//
 //	"sectorNumber" -- the disk sector to be written
 //	"data" -- the new contents of the disk sector
 //----------------------------------------------------------------------
@@ -90,20 +232,987 @@ SynchDisk::ReadSector(int sectorNumber, char* data)
 void
 SynchDisk::WriteSector(int sectorNumber, const char* data)
 {
-    lock->Acquire();			// only one disk I/O at a time
-    disk->WriteRequest(sectorNumber, data);
-    semaphore->P();			// wait for interrupt
+    CacheEntry *entry;
+    LoggedSector *copy;
+    char *buffer;
+
+    if (journalSector != -1) {
+	journalLock->Acquire();
+	if (FindLogged(sectorNumber) != NULL) {
+	    if (numOperations == 0)
+		Commit();
+	    Checkpoint();
+	}
+	copy = FindLogged(sectorNumber);
+	if (copy != NULL) {		// still running: forget the change
+	    buffer = copy->data;
+	    *copy = logged[--numLogged];
+	    logged[numLogged].data = buffer;
+	    logged[numLogged].committed = NULL;
+	    numRunning--;
+	}
+	journalLock->Release();
+    }
+    if (cacheSize == 0) {
+	Transfer(sectorNumber, (char *) data, true);
+	return;
+    }
+    lock->Acquire();
+    entry = GetEntry(sectorNumber, false);
+    bcopy(data, entry->data, SectorSize);
+    entry->dirty = true;
+    MakeRecent(entry);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Prefetch
+// 	Start reading a sector into the cache, without waiting for it.
+//	A later ReadSector of the sector finds it in the cache (or, if
+//	the transfer is not over yet, waits only for the rest of it).
+//
+//	This is only a hint: nothing is done if the sector is already
+//	cached, or kept by the journal, or if making room for it would
+//	mean waiting for a dirty or busy entry.
+//
+//	"sectorNumber" -- the disk sector to read ahead
+//	"background" -- if true, the disk serves every other request
+//		first, until some thread waits for this one
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Prefetch(int sectorNumber, bool background)
+{
+    CacheEntry *entry;
+    bool journaled = false;
+
+    if (cacheSize == 0)
+	return;
+    if (journalSector != -1) {
+	journalLock->Acquire();
+	journaled = (FindLogged(sectorNumber) != NULL);
+	journalLock->Release();
+    }
+    if (journaled)
+	return;
+    lock->Acquire();
+    if (Lookup(sectorNumber) == NULL) {
+	entry = lruLast;
+	if (!entry->busy && !entry->dirty) {
+	    Rename(entry, sectorNumber);
+	    MakeRecent(entry);
+	    StartRequest(entry, false, background);
+	}
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadTrack
+// 	Read a sector, as ReadSector does; if it was not in the cache,
+//	also start reading the other sectors of its track, without
+//	waiting for them.  Once the disk head has moved to a track, the
+//	track buffer holds the sectors that pass under it, so the rest of
+//	the track costs little more than the time to transfer it -- as
+//	long as nothing takes the head to another track first.  C-LOOK
+//	serves the requests on the current track before any other, the
+//	closest first.
+//
+//	The sectors are asked for in the order they come under the head
+//	after "sectorNumber", wrapping around to the start of the track,
+//	through Prefetch; the ones already cached, kept by the journal,
+//	or for which there is no clean idle entry are skipped.  They are
+//	read in the background, so that they never hold up a sector some
+//	thread is waiting for.  At most half of the cache is given to
+//	them, so that a track read does not wipe out the cache.
+//
+//	"sectorNumber" -- the disk sector to read
+//	"data" -- the buffer to hold the contents of the disk sector
+//----------------------------------------------------------------------
+
+void
+SynchDisk::ReadTrack(int sectorNumber, char* data)
+{
+    int first = sectorNumber - sectorNumber % SectorsPerTrack;
+    int count = SectorsPerTrack - 1;
+
+    if (ReadCached(sectorNumber, data) || cacheSize == 0)
+	return;
+    if (count > cacheSize / 2)
+	count = cacheSize / 2;
+    for (int i = 1; i <= count; i++)
+	Prefetch(first + (sectorNumber - first + i) % SectorsPerTrack, true);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Flush
+// 	Write every dirty sector in the cache back to disk, and wait
+//	until they are all written.  The sectors are queued in increasing
+//	order, so the disk head sweeps across the disk once.
+//
+//	The journal is committed and checkpointed first, so that once the
+//	disk is flushed, every change is in its place -- but for those of
+//	an operation still under way, which stay in the running
+//	transaction.  Last, the disk makes sure its UNIX file has every
+//	change, if it is mapped into memory.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Flush()
+{
+    List<CacheEntry *> *dirtyList = new List<CacheEntry *>;
+
+    if (journalSector != -1) {
+	journalLock->Acquire();
+	if (numOperations == 0)
+	    Commit();
+	Checkpoint();
+	journalLock->Release();
+    }
+    lock->Acquire();
+    for (int i = 0; i < cacheSize; i++)
+	if (cache[i].dirty && !cache[i].busy)
+	    dirtyList->SortedInsert(&cache[i], cache[i].sector);
+    while (!dirtyList->IsEmpty())
+	StartRequest(dirtyList->Remove(), true);
+    for (int i = 0; i < cacheSize; i++)
+	WaitFor(&cache[i]);
+    disk->Sync();
+    lock->Release();
+    delete dirtyList;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Shutdown
+// 	Write the cache back to disk, because the machine is halting.
+//	From now on no thread can be put to sleep waiting for the disk,
+//	so requests are completed by polling the interrupt simulation.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Shutdown()
+{
+    halted = true;
+    Flush();
+}
+
+//----------------------------------------------------------------------
+// Checksum
+// 	Compute the checksum of a journal record: of its sequence number,
+//	and of the contents of its "count" sectors.  A record whose end
+//	did not reach the disk does not match it.
+//----------------------------------------------------------------------
+
+static int
+Checksum(int recordSequence, char **data, int count)
+{
+    unsigned int sum = recordSequence;
+
+    for (int i = 0; i < count; i++)
+	for (int j = 0; j < SectorSize / (int) sizeof(int); j++)
+	    sum = ((sum << 1) | (sum >> 31)) + ((unsigned int *) data[i])[j];
+    return (int) sum;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::FormatJournal
+// 	Set up an empty journal on a disk being formatted.  The log is
+//	cleared, so that no record left over from an earlier use of the
+//	disk can be mistaken for a new one.
+//
+//	"sector" -- where to put the journal header
+//	"first" -- the first of the (consecutive) sectors of the log
+//	"size" -- how many sectors the log has
+//----------------------------------------------------------------------
+
+void
+SynchDisk::FormatJournal(int sector, int first, int size)
+{
+    char *zero = new char[SectorSize];
+    int *sectors = new int[size];
+    char **data = new char *[size];
+
+    ASSERT(sizeof(JournalRecord) == MinSectorSize);
+    ASSERT(size >= 2 * (1 + MaxRecordSectors));
+    bzero(zero, SectorSize);
+    for (int i = 0; i < size; i++) {
+	sectors[i] = first + i;
+	data[i] = zero;
+    }
+    TransferAll(size, sectors, data, true);
+    delete [] zero;
+    delete [] sectors;
+    delete [] data;
+
+    journal.magic = JournalMagic;
+    journal.first = first;
+    journal.size = size;
+    journal.tail = head = 0;
+    journal.sequence = sequence = 1;
+    journalSector = sector;
+    logged = new LoggedSector[size];
+    WriteJournalHeader();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::OpenJournal
+// 	Start using the journal whose header is at "sector", first
+//	replaying whatever records it holds -- unless "replay" is false,
+//	because the disk was shut down cleanly, and so the log is empty.
+//	Return false if the disk has no journal (it was formatted by an
+//	earlier version of Nachos); then metadata is written in place, as
+//	LogSector falls back to WriteSector.
+//----------------------------------------------------------------------
+
+bool
+SynchDisk::OpenJournal(int sector, bool replay)
+{
+    char *buffer = new char[SectorSize];
+
+    Transfer(sector, buffer, false);
+    bcopy(buffer, (char *) &journal, sizeof(JournalHeader));
+    delete [] buffer;
+    if (journal.magic != JournalMagic)
+	return false;
+    journalSector = sector;
+    logged = new LoggedSector[journal.size];
+    head = journal.tail;
+    sequence = journal.sequence;
+    if (replay)
+	Replay();
+    return true;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Replay
+// 	Write every complete transaction in the log, starting at the
+//	tail, to the places its sectors belong, and then mark the log
+//	empty.  The records follow each other with increasing sequence
+//	numbers; the first one that is missing, or that fails its
+//	checksum, ends the log.  A transaction ends with a record that
+//	is not marked ContinuedMagic; so the log is first read through
+//	to find the end of the last complete one, and only then are its
+//	records replayed.  Writing a record again that was already
+//	checkpointed does no harm.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Replay()
+{
+    JournalRecord record;
+    char *buffer = new char[MaxRecordSectors * SectorSize];
+    int sectors[MaxRecordSectors];
+    char *data[MaxRecordSectors];
+    int end = journal.tail, endSequence = journal.sequence;
+    bool complete;
+
+    head = journal.tail;
+    sequence = journal.sequence;
+    while (ReadRecord(head, sequence, &record, buffer)) {
+	head = (head + 1 + record.count) % journal.size;
+	sequence++;
+	if (record.magic == RecordMagic) {
+	    end = head;
+	    endSequence = sequence;
+	}
+    }
+
+    head = journal.tail;
+    sequence = journal.sequence;
+    while (head != end) {
+	complete = ReadRecord(head, sequence, &record, buffer);
+	ASSERT(complete);
+	for (int i = 0; i < record.count; i++) {
+	    sectors[i] = record.sectors[i];
+	    data[i] = &buffer[i * SectorSize];
+	}
+	DEBUG('f', "Replaying journal record %d, of %d sectors.\n",
+						sequence, record.count);
+	TransferAll(record.count, sectors, data, true);
+	for (int i = 0; i < record.count; i++)
+	    UpdateCached(record.sectors[i], data[i]);
+	head = (head + 1 + record.count) % journal.size;
+	sequence++;
+    }
+    ASSERT(sequence == endSequence);
+    if (head != journal.tail) {
+	journal.tail = head;
+	journal.sequence = sequence;
+	WriteJournalHeader();
+    }
+    delete [] buffer;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadRecord
+// 	Read the record at "position" in the log into "record", and the
+//	contents of its sectors into "buffer".  Return false if it is
+//	not the record numbered "recordSequence", or if it was not
+//	completely written.
+//----------------------------------------------------------------------
+
+bool
+SynchDisk::ReadRecord(int position, int recordSequence,
+				JournalRecord *record, char *buffer)
+{
+    int sectors[MaxRecordSectors];
+    char *data[MaxRecordSectors];
+
+    Transfer(journal.first + position, buffer, false);
+    bcopy(buffer, (char *) record, sizeof(JournalRecord));
+    if ((record->magic != RecordMagic && record->magic != ContinuedMagic)
+		|| record->sequence != recordSequence
+		|| record->count < 1 || record->count > MaxRecordSectors)
+	return false;
+    for (int i = 0; i < record->count; i++) {
+	sectors[i] = journal.first + (position + 1 + i) % journal.size;
+	data[i] = &buffer[i * SectorSize];
+    }
+    TransferAll(record->count, sectors, data, false);
+    return Checksum(recordSequence, data, record->count) == record->checksum;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::LogSector
+// 	Write a sector of metadata through the journal: its new contents
+//	are added to the running transaction, which is only written to
+//	the log later on, along with the changes of other operations
+//	(group commit).  A sector changed many times before then is
+//	logged once, with its latest contents; if it is also in a record
+//	still in the log, the contents there are kept too, for Checkpoint.
+//
+//	If the running transaction has as many sectors as a record can
+//	list, it is written first -- unless an operation is under way,
+//	in which case it just grows (making room in the log, if need be,
+//	by checkpointing what was committed before).
+//
+//	"sectorNumber" -- the disk sector to be written
+//	"data" -- the new contents of the disk sector
+//----------------------------------------------------------------------
+
+void
+SynchDisk::LogSector(int sectorNumber, const char* data)
+{
+    LoggedSector *copy;
+
+    if (journalSector == -1) {
+	WriteSector(sectorNumber, data);
+	return;
+    }
+    journalLock->Acquire();
+    copy = FindLogged(sectorNumber);
+    if (copy == NULL || !copy->running) {	// one more running sector
+	if (numRunning >= MaxRecordSectors && numOperations == 0)
+	    Commit();
+	else if (!LogHasRoom(numRunning + 1))
+	    Checkpoint();
+	ASSERT(LogHasRoom(numRunning + 1));	// else the log is too small
+	copy = FindLogged(sectorNumber);	// may have been checkpointed
+    }
+    if (copy == NULL) {
+	ASSERT(numLogged < journal.size);
+	copy = &logged[numLogged++];
+	copy->sector = sectorNumber;
+	copy->running = true;
+	numRunning++;
+    } else if (!copy->running) {		// keep what the log has
+	copy->committed = copy->data;
+	copy->data = new char[SectorSize];
+	copy->running = true;
+	numRunning++;
+    }
+    bcopy(data, copy->data, SectorSize);
+    UpdateCached(sectorNumber, data);
+    journalLock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::BeginOperation/EndOperation
+// 	Bracket the changes made by a file system operation, such as
+//	creating a file, so that they are all written in the same
+//	transaction -- after a crash, either all of them are replayed,
+//	or none.  The running transaction is not written while any
+//	operation is under way; if it might not have room in one record
+//	for another operation, it is written before the operation starts
+//	(if no other one is under way), and once the last operation ends
+//	if it has grown past a record meanwhile.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::BeginOperation()
+{
+    if (journalSector == -1)
+	return;
+    journalLock->Acquire();
+    if (numOperations == 0
+		&& numRunning > MaxRecordSectors - MaxOperationSectors)
+	Commit();
+    numOperations++;
+    journalLock->Release();
+}
+
+void
+SynchDisk::EndOperation()
+{
+    if (journalSector == -1)
+	return;
+    journalLock->Acquire();
+    ASSERT(numOperations > 0);
+    if (--numOperations == 0 && numRunning > MaxRecordSectors)
+	Commit();
+    journalLock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::FindLogged
+// 	Return the journal's copy of "sectorNumber", or NULL if the
+//	sector has not been changed through the journal since the last
+//	checkpoint.  There are never more of them than there are sectors
+//	in the log, so they are just searched in order.
+//
+//	The caller must hold "journalLock".
+//----------------------------------------------------------------------
+
+LoggedSector *
+SynchDisk::FindLogged(int sectorNumber)
+{
+    for (int i = 0; i < numLogged; i++)
+	if (logged[i].sector == sectorNumber)
+	    return &logged[i];
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::LogHasRoom
+// 	Return true if "count" more sectors can be written to the log,
+//	along with the descriptors of the records they take.  The log is
+//	never let fill up completely, so that its head and its tail are
+//	only in the same place when it is empty.
+//
+//	The caller must hold "journalLock".
+//----------------------------------------------------------------------
+
+bool
+SynchDisk::LogHasRoom(int count)
+{
+    int used = (head - journal.tail + journal.size) % journal.size;
+
+    return count + divRoundUp(count, MaxRecordSectors) < journal.size - used;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Commit
+// 	Write the running transaction to the log, checkpointing first if
+//	the log does not have room for it.  If the log then no longer
+//	has room for a full record, checkpoint it, so that the next
+//	commit can most likely go ahead without.
+//
+//	The caller must hold "journalLock", and no operation may be
+//	under way.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Commit()
+{
+    ASSERT(numOperations == 0);
+    if (numRunning == 0)
+	return;
+    if (!LogHasRoom(numRunning))
+	Checkpoint();
+    WriteRecord();
+    if (!LogHasRoom(MaxRecordSectors))
+	Checkpoint();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteRecord
+// 	Write the running transaction at the head of the log, as a
+//	descriptor sector followed by the sectors changed -- or, if it
+//	has more sectors than a descriptor can list, as several such
+//	records -- in one sweep of the disk head.  The log is circular,
+//	so a record may wrap around its end.
+//
+//	The caller must hold "journalLock".
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WriteRecord()
+{
+    JournalRecord record;
+    int records = divRoundUp(numRunning, MaxRecordSectors);
+    int total = records + numRunning;
+    int *sectors = new int[total];
+    char **data = new char *[total];
+    char *descriptors = new char[records * SectorSize];
+    int position = 0, next = 0, descriptor;
+
+    bzero(descriptors, records * SectorSize);
+    for (int r = 0; r < records; r++) {
+	bzero((char *) &record, sizeof(JournalRecord));
+	descriptor = position++;
+	sectors[descriptor] = journal.first + (head + descriptor)
+							% journal.size;
+	data[descriptor] = &descriptors[r * SectorSize];
+	for (; next < numLogged && record.count < MaxRecordSectors; next++)
+	    if (logged[next].running) {
+		logged[next].running = false;
+		delete [] logged[next].committed;
+		logged[next].committed = NULL;
+		record.sectors[record.count++] = logged[next].sector;
+		sectors[position] = journal.first + (head + position)
+							% journal.size;
+		data[position++] = logged[next].data;
+	    }
+	record.magic = (r < records - 1) ? ContinuedMagic : RecordMagic;
+	record.sequence = sequence;
+	record.checksum = Checksum(sequence, &data[descriptor + 1],
+								record.count);
+	bcopy((char *) &record, data[descriptor], sizeof(JournalRecord));
+	DEBUG('f', "Writing journal record %d, of %d sectors.\n",
+						sequence, record.count);
+	sequence++;
+	stats->numJournalRecords++;
+    }
+    ASSERT(position == total);
+    TransferAll(total, sectors, data, true);
+    head = (head + total) % journal.size;
+    numRunning = 0;
+    delete [] sectors;
+    delete [] data;
+    delete [] descriptors;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Checkpoint
+// 	Write every sector in the records of the log to its place on
+//	disk, and then move the tail of the log up to its head: the
+//	records there will not be needed again.  The sectors of the
+//	running transaction stay in memory; those of them that are in
+//	the log as well are written home with the contents they have
+//	there, so that nothing reaches its place before it is in the log.
+//
+//	The caller must hold "journalLock".
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Checkpoint()
+{
+    int *sectors;
+    char **data;
+    int count = 0, kept = 0;
+    char *buffer;
+
+    if (head == journal.tail)
+	return;				// the log is empty
+    sectors = new int[numLogged];
+    data = new char *[numLogged];
+    for (int i = 0; i < numLogged; i++)
+	if (!logged[i].running || logged[i].committed != NULL) {
+	    sectors[count] = logged[i].sector;
+	    data[count++] = logged[i].running ? logged[i].committed
+					      : logged[i].data;
+	}
+    DEBUG('f', "Checkpointing %d journaled sectors.\n", count);
+    TransferAll(count, sectors, data, true);
+    for (int i = 0; i < numLogged; i++)	// keep only the running ones
+	if (logged[i].running) {
+	    delete [] logged[i].committed;
+	    logged[i].committed = NULL;
+	    if (i != kept) {
+		buffer = logged[kept].data;
+		logged[kept] = logged[i];
+		logged[i].data = buffer;
+	    }
+	    kept++;
+	}
+    numLogged = kept;
+    journal.tail = head;
+    journal.sequence = sequence;
+    WriteJournalHeader();
+    stats->numCheckpoints++;
+    delete [] sectors;
+    delete [] data;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteJournalHeader
+// 	Write the journal header back to its sector.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WriteJournalHeader()
+{
+    char *buffer = new char[SectorSize];
+
+    bzero(buffer, SectorSize);
+    bcopy((char *) &journal, buffer, sizeof(JournalHeader));
+    Transfer(journalSector, buffer, true);
+    delete [] buffer;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::UpdateCached
+// 	If "sectorNumber" is in the cache, give it the contents "data",
+//	which the journal will put on disk; the entry is left clean, so
+//	that it is never written back ahead of the journal.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::UpdateCached(int sectorNumber, const char* data)
+{
+    CacheEntry *entry;
+
+    if (cacheSize == 0)
+	return;
+    lock->Acquire();
+    while ((entry = Lookup(sectorNumber)) != NULL && entry->busy)
+	WaitFor(entry);
+    if (entry != NULL) {
+	bcopy(data, entry->data, SectorSize);
+	entry->dirty = false;
+    }
     lock->Release();
 }
 
+//----------------------------------------------------------------------
+// SynchDisk::GetEntry
+// 	Return the cache entry for "sectorNumber", making room for it
+//	if the sector is not cached.  If "fill" is true, the entry is
+//	returned holding the contents of the sector; otherwise a new
+//	entry is returned uninitialized, since the caller is about to
+//	overwrite all of it.
+//
+//	Waiting for the disk releases the cache lock, and anything may
+//	have happened to the cache by the time we get it back, so after
+//	every wait we start over.
+//
+//	The caller must hold "lock".
+//----------------------------------------------------------------------
+
+CacheEntry *
+SynchDisk::GetEntry(int sectorNumber, bool fill)
+{
+    CacheEntry *entry;
+
+    for (;;) {
+	entry = Lookup(sectorNumber);
+	if (entry != NULL) {
+	    if (!entry->busy)
+		return entry;
+	    WaitFor(entry);		// being read or written
+	    continue;
+	}
+	for (entry = lruLast; entry->busy && entry->prev != NULL;
+							entry = entry->prev)
+	    ;				// least recently used idle entry
+	if (entry->busy)
+	    WaitFor(entry);		// every entry is busy
+	else if (entry->dirty) {
+	    StartRequest(entry, true);	// write it back before reusing it
+	    WaitFor(entry);
+	} else {
+	    Rename(entry, sectorNumber);
+	    if (!fill)
+		return entry;
+	    MakeRecent(entry);
+	    StartRequest(entry, false);
+	    WaitFor(entry);
+	}
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Lookup
+// 	Return the cache entry holding "sectorNumber", or NULL if the
+//	sector is not cached.
+//----------------------------------------------------------------------
+
+CacheEntry *
+SynchDisk::Lookup(int sectorNumber)
+{
+    CacheEntry *entry = hashTable[sectorNumber % numBuckets];
+
+    while (entry != NULL && entry->sector != sectorNumber)
+	entry = entry->hashNext;
+    return entry;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Rename
+// 	Assign a clean, idle cache entry to "sectorNumber", moving it to
+//	the right hash bucket.  The contents of the entry are left for
+//	the caller to fill in.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Rename(CacheEntry *entry, int sectorNumber)
+{
+    CacheEntry **ptr;
+
+    ASSERT(!entry->busy && !entry->dirty);
+    if (entry->sector != -1) {
+	for (ptr = &hashTable[entry->sector % numBuckets]; *ptr != entry;
+						ptr = &(*ptr)->hashNext)
+	    ;
+	*ptr = entry->hashNext;
+    }
+    entry->sector = sectorNumber;
+    entry->hashNext = hashTable[sectorNumber % numBuckets];
+    hashTable[sectorNumber % numBuckets] = entry;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Forget
+// 	Take an idle entry out of its hash bucket, and make it the next
+//	one to be reused, because it does not hold what it was meant to
+//	(cf. StartNext).
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Forget(CacheEntry *entry)
+{
+    CacheEntry **ptr;
+
+    ASSERT(!entry->busy && !entry->dirty && entry->sector != -1);
+    for (ptr = &hashTable[entry->sector % numBuckets]; *ptr != entry;
+						ptr = &(*ptr)->hashNext)
+	;
+    *ptr = entry->hashNext;
+    entry->sector = -1;
+    Detach(entry);
+    entry->next = NULL;
+    entry->prev = lruLast;
+    if (lruLast != NULL)
+	lruLast->next = entry;
+    else
+	lruFirst = entry;
+    lruLast = entry;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Detach/MakeRecent
+// 	Maintain the LRU list: take an entry out of it, or move it to the
+//	front of it (as the most recently used entry).
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Detach(CacheEntry *entry)
+{
+    if (entry->prev != NULL)
+	entry->prev->next = entry->next;
+    else
+	lruFirst = entry->next;
+    if (entry->next != NULL)
+	entry->next->prev = entry->prev;
+    else
+	lruLast = entry->prev;
+}
+
+void
+SynchDisk::MakeRecent(CacheEntry *entry)
+{
+    Detach(entry);
+    entry->prev = NULL;
+    entry->next = lruFirst;
+    if (lruFirst != NULL)
+	lruFirst->prev = entry;
+    else
+	lruLast = entry;
+    lruFirst = entry;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Transfer
+// 	Read or write a sector straight between the disk and "data",
+//	bypassing the cache (used when the cache is turned off, and by
+//	the journal), and wait until it is done.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Transfer(int sectorNumber, char* data, bool writing)
+{
+    TransferAll(1, &sectorNumber, &data, writing);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::TransferAll
+// 	Read or write "count" sectors straight between the disk and
+//	memory, bypassing the cache.  All the requests are queued before
+//	we wait for any of them, so the disk serves them in a single
+//	sweep.
+//
+//	"sectors" -- the disk sectors to read or write
+//	"data" -- the buffer for each of them
+//----------------------------------------------------------------------
+
+void
+SynchDisk::TransferAll(int count, int *sectors, char **data, bool writing)
+{
+    CacheEntry *requests = new CacheEntry[count];
+
+    lock->Acquire();
+    for (int i = 0; i < count; i++) {
+	requests[i].sector = sectors[i];
+	requests[i].data = data[i];
+	requests[i].busy = false;
+	requests[i].waiters = 0;
+	requests[i].ready = new Semaphore("disk request", 0);
+	StartRequest(&requests[i], writing);
+    }
+    for (int i = 0; i < count; i++)
+	WaitFor(&requests[i]);
+    lock->Release();
+    for (int i = 0; i < count; i++)
+	delete requests[i].ready;
+    delete [] requests;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartRequest
+// 	Put a request to read or write "entry" on the queue of pending
+//	requests, and send it to the disk if the disk is idle.  The
+//	entry is busy until the request is done.  A "background" request
+//	is served only when no other request is pending.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::StartRequest(CacheEntry *entry, bool writing, bool background)
+{
+    IntStatus oldLevel = interrupt->SetLevel(IntOff);
+    CacheEntry **ptr;
+
+    ASSERT(!entry->busy);
+    entry->busy = true;
+    entry->writing = writing;
+    entry->background = background;
+    entry->deadline = stats->totalTicks + DiskDeadline;
+    entry->queueNext = NULL;
+    for (ptr = &pending; *ptr != NULL; ptr = &(*ptr)->queueNext)
+	;				// append, to keep arrival order
+    *ptr = entry;
+    if (active == NULL)
+	StartNext();
+    (void) interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartNext
+// 	Send the next pending request, if any, to the disk.  Called with
+//	interrupts disabled, when the disk is idle.  Background requests
+//	are left for when there is nothing else to do, and given up
+//	once the head has left their track: then they would take a seek.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::StartNext()
+{
+    CacheEntry **ptr, **next = NULL, *entry;
+    bool others = false;
+
+    for (ptr = &pending; *ptr != NULL; )
+	if ((*ptr)->background && (*ptr)->sector / SectorsPerTrack
+					!= headSector / SectorsPerTrack) {
+	    entry = *ptr;
+	    *ptr = entry->queueNext;
+	    entry->busy = false;
+	    Forget(entry);
+	} else
+	    ptr = &(*ptr)->queueNext;
+    if (pending == NULL)
+	return;
+    for (ptr = &pending; *ptr != NULL && !others; ptr = &(*ptr)->queueNext)
+	others = !(*ptr)->background;
+    for (ptr = &pending; *ptr != NULL; ptr = &(*ptr)->queueNext) {
+	if (others && (*ptr)->background)
+	    continue;
+	if (next == NULL) {
+	    next = ptr;			// oldest request
+	    if (policy == FifoPolicy || (policy == DeadlinePolicy
+				&& (*next)->deadline <= stats->totalTicks))
+		break;
+	} else if (ServeBefore(*ptr, *next))
+	    next = ptr;
+    }
+    active = *next;
+    *next = active->queueNext;		// take it off the queue
+    headSector = active->sector;
+    if (active->writing)
+	disk->WriteRequest(active->sector, active->data);
+    else
+	disk->ReadRequest(active->sector, active->data);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ServeBefore
+// 	Return true if C-LOOK scheduling should serve request "a" before
+//	request "b".  Tracks are ranked by how far the head has to sweep
+//	forward (wrapping around after the last track) to reach them;
+//	on the same track, the request with the shortest latency wins.
+//----------------------------------------------------------------------
+
+bool
+SynchDisk::ServeBefore(CacheEntry *a, CacheEntry *b)
+{
+    int headTrack = headSector / SectorsPerTrack;
+    int aheadA = (a->sector / SectorsPerTrack - headTrack + NumTracks)
+								% NumTracks;
+    int aheadB = (b->sector / SectorsPerTrack - headTrack + NumTracks)
+								% NumTracks;
+
+    if (aheadA != aheadB)
+	return aheadA < aheadB;
+    return disk->ComputeLatency(a->sector, a->writing)
+			< disk->ComputeLatency(b->sector, b->writing);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WaitFor
+// 	Wait until no request is outstanding on "entry".  The caller
+//	holds "lock", which is released while we sleep.
+//
+//	Normally the thread just sleeps; once the machine is halting
+//	there may be nobody left to switch to, so instead we advance
+//	simulated time until the interrupt has arrived.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WaitFor(CacheEntry *entry)
+{
+    IntStatus oldLevel = interrupt->SetLevel(IntOff);
+
+    if (halted) {
+	while (entry->busy)
+	    interrupt->Idle();
+    } else if (entry->busy) {
+	entry->background = false;	// somebody needs it now
+	entry->waiters++;
+	lock->Release();
+	entry->ready->P();		// wait for interrupt
+	(void) interrupt->SetLevel(oldLevel);
+	lock->Acquire();
+	return;
+    }
+    (void) interrupt->SetLevel(oldLevel);
+}
+
 //----------------------------------------------------------------------
 // SynchDisk::RequestDone
 // 	Disk interrupt handler.  Wake up any thread waiting for the disk
-//	request to finish.
+//	request to finish, and start the next one.
 //----------------------------------------------------------------------
 
 void
 SynchDisk::RequestDone()
 { 
-    semaphore->V();
+    CacheEntry *entry = active;
+
+    active = NULL;
+    if (entry->writing)
+	entry->dirty = false;
+    entry->busy = false;
+    while (entry->waiters > 0) {
+	entry->waiters--;
+	entry->ready->V();
+    }
+    StartNext();
 }
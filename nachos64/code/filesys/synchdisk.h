@@ -14,6 +14,112 @@
 #include "disk.h"
 #include "synch.h"
 
+// Number of sectors kept in the buffer cache, unless overridden with
+// the "-cache" command line flag.  A size of 0 disables the cache.
+#define DefaultCacheSize	64
+
+// The order in which the requests waiting for the disk are served;
+// chosen with the "-ds" command line flag.
+enum DiskPolicy { FifoPolicy, CLookPolicy, DeadlinePolicy };
+extern const char *PolicyNames[];	// printable names, by DiskPolicy
+
+// Under the deadline policy, how long (in ticks) a request may wait
+// before it is served ahead of requests closer to the disk head.
+#define DiskDeadline		(20 * (SeekTime + RotationTime))
+
+// Changes to the metadata of the file system (file headers, directories
+// and the bitmap) can be written through a journal: a circular log of
+// sectors on disk.  The changes are gathered in memory into a running
+// transaction, which is then written to the log as a single record --
+// a descriptor sector, listing where the changes belong, followed by
+// their new contents -- in one sequential sweep.  The sectors are only
+// written to their own places on disk ("checkpointed") later on, when
+// the log is getting full.  If Nachos stops before that, the records
+// still in the log are written out again the next time the disk is
+// used; a record that was not completely written fails its checksum
+// and is ignored, along with everything after it.
+//
+// A transaction with more sectors than a record can list is written
+// as several records in a row, all but the last marked ContinuedMagic;
+// they are replayed only if the last one made it to the log.
+#define JournalMagic		0x4e4a524e
+#define RecordMagic		0x4e524543
+#define ContinuedMagic		0x4e434f4e
+#define MaxRecordSectors	((int) ((MinSectorSize - 4 * sizeof(int)) \
+							/ sizeof(int)))
+
+// The running transaction is never written while an operation is
+// under way (see BeginOperation), so that all of its changes are in
+// the same transaction.  It is written before an operation starts if
+// it might not have room for this many more sectors in one record; an
+// operation that changes more makes it grow past a record instead.
+#define MaxOperationSectors	12
+
+// The journal header, which is kept in a sector of its own, tells where
+// the log is, and where in it the records to be replayed start.
+class JournalHeader {
+  public:
+    int magic;				// JournalMagic
+    int first;				// First sector of the log
+    int size;				// Number of sectors in the log
+    int tail;				// Position of the oldest record not
+					// yet checkpointed,
+    int sequence;			// and its sequence number
+};
+
+// The descriptor sector at the start of each record in the log (laid
+// out for MinSectorSize, like the file headers).
+class JournalRecord {
+  public:
+    int magic;				// RecordMagic, or ContinuedMagic
+    int sequence;			// One more than the previous record's
+    int count;				// Number of sectors in the record
+    int checksum;			// Of the sequence number and the
+					// contents of the sectors
+    int sectors[MaxRecordSectors];	// Where each sector belongs
+};
+
+// A sector changed through the journal, and not yet checkpointed.
+class LoggedSector {
+  public:
+    LoggedSector() { data = new char[SectorSize]; committed = NULL; }
+    ~LoggedSector() { delete [] data; delete [] committed; }
+
+    int sector;				// Where it belongs on disk
+    bool running;			// Changed since the last record was
+					// written?
+    char *data;				// Its latest contents
+    char *committed;			// If it is running, and also in a
+					// record in the log: its contents
+					// there; otherwise NULL
+};
+
+// The following class defines an entry of the sector buffer cache.
+// Each entry holds the contents of one disk sector; entries are
+// chained into a hash bucket (for lookup by sector number) and into
+// a list ordered by recency of use (for replacement).
+//
+// An entry is "busy" while a request to read or write it is queued
+// for, or being serviced by, the disk.
+
+class CacheEntry {
+  public:
+    int sector;				// Sector cached here, -1 if unused
+    bool dirty;				// Modified since last written to disk?
+    bool busy;				// Disk request outstanding?
+    bool writing;			// If so, is it a write?
+    bool background;			// Is it a read nobody has asked for
+					// yet, which other requests go before?
+    int waiters;			// Threads waiting for the request
+    Semaphore *ready;			// Signalled when the request is done
+    int deadline;			// When the request should be served
+    CacheEntry *queueNext;		// Next pending request
+    char *data;				// Contents of the sector
+    CacheEntry *hashNext;		// Next entry in the same hash bucket
+    CacheEntry *prev;			// Neighbours in the LRU list
+    CacheEntry *next;
+};
+
 // The following class defines a "synchronous" disk abstraction.
 // As with other I/O devices, the raw physical disk is an asynchronous device --
 // requests to read or write portions of the disk return immediately,
@@ -24,10 +130,18 @@
 // This class provides the abstraction that for any individual thread
 // making a request, it waits around until the operation finishes before
 // returning.
+//
+// Sectors are kept in a bounded, write-back buffer cache: reads of
+// cached sectors and all writes are satisfied from memory, and
+// modified sectors go to disk only when they are evicted, or when
+// Flush is called.
 class SynchDisk {
   public:
-    SynchDisk(const char* name);    	// Initialize a synchronous disk,
-					// by initializing the raw Disk.
+    SynchDisk(const char* name, int numEntries = DefaultCacheSize,
+		DiskPolicy order = CLookPolicy, bool mapFile = false);
+    					// Initialize a synchronous disk,
+					// by initializing the raw Disk
+					// (its file mapped, if "mapFile").
     ~SynchDisk();			// De-allocate the synch disk data
     
     void ReadSector(int sectorNumber, char* data);
@@ -37,17 +151,114 @@ class SynchDisk {
     					// Disk::ReadRequest/WriteRequest and
 					// then wait until the request is done.
     void WriteSector(int sectorNumber, const char* data);
+    void Prefetch(int sectorNumber, bool background = false);
+					// Start reading a sector into the
+					// cache, without waiting for it (and
+					// if "background", only while the
+					// disk has nothing else to do)
+    void ReadTrack(int sectorNumber, char* data);
+					// Read a sector, and if it was not
+					// cached, start reading the rest of
+					// its track into the cache
     
+    void Flush();			// Write every dirty cached sector
+					// back to disk, and checkpoint the
+					// journal
+    void Shutdown();			// Flush the cache as the machine
+					// halts; called by Interrupt::Halt
+
+    void FormatJournal(int sector, int first, int size);
+					// Set up an empty journal, of "size"
+					// sectors starting at "first", with
+					// its header at "sector"
+    bool OpenJournal(int sector, bool replay = true);
+					// Use (and replay, unless the disk was
+					// shut down cleanly) the journal whose
+					// header is at "sector"; false if
+					// there is none
+    void LogSector(int sectorNumber, const char* data);
+					// Write a metadata sector through the
+					// journal (or, if there is none, as
+					// WriteSector does)
+    void BeginOperation();		// Bracket the changes that have to
+    void EndOperation();		// reach the disk all or none at all
+
     void RequestDone();			// Called by the disk device interrupt
 					// handler, to signal that the
 					// current disk operation is complete.
 
   private:
     Disk *disk;		  		// Raw disk device
-    Semaphore *semaphore; 		// To synchronize requesting thread 
-					// with the interrupt handler
-    Lock *lock;		  		// Only one read/write request
-					// can be sent to the disk at a time
+    Lock *lock;		  		// Protects the cache; released
+					// while waiting for the disk
+    CacheEntry *active;			// Request the disk is working on
+    CacheEntry *pending;		// Requests waiting for the disk,
+					// which handles one at a time,
+					// in order of arrival
+    DiskPolicy policy;			// Which pending request goes next
+    int headSector;			// Last sector sent to the disk
+    bool halted;			// Once the machine is halting, no
+					// thread may sleep; poll instead
+
+    int cacheSize;			// Number of entries in the cache
+    CacheEntry *cache;			// The cache entries
+    CacheEntry **hashTable;		// Buckets, indexed by sector number
+    int numBuckets;
+    CacheEntry *lruFirst;		// Most recently used entry
+    CacheEntry *lruLast;		// Least recently used entry
+
+    Lock *journalLock;			// Protects the journal; held while
+					// records are written
+    int journalSector;			// Where the journal header is, or -1
+					// if there is no journal
+    JournalHeader journal;		// The journal header, in memory
+    int head;				// Where the next record goes in the
+    int sequence;			// log, and its sequence number
+    LoggedSector *logged;		// Sectors changed since the last
+    int numLogged;			// checkpoint,
+    int numRunning;			// of which these are in the running
+					// transaction
+    int numOperations;			// Number of operations under way
+
+    LoggedSector *FindLogged(int sectorNumber);
+					// The logged copy of a sector, if any
+    bool LogHasRoom(int count);		// Can "count" sectors be logged?
+    void Commit();			// Write the running transaction to the
+					// log, and checkpoint if it is full
+    void WriteRecord();			// Write the running transaction
+    void Checkpoint();			// Write the committed sectors home,
+					// and empty the log
+    void Replay();			// Write home what the log holds
+    bool ReadRecord(int position, int recordSequence,
+			JournalRecord *record, char *buffer);
+					// Read and check a record in the log
+    void WriteJournalHeader();		// Write "journal" back to disk
+    void UpdateCached(int sectorNumber, const char* data);
+					// Bring a cached copy up to date
+    bool ReadCached(int sectorNumber, char* data);
+					// ReadSector; was the sector in
+					// memory?
+
+    CacheEntry *GetEntry(int sectorNumber, bool fill);
+					// Find or make room for a sector
+    CacheEntry *Lookup(int sectorNumber);	// Find a cached sector
+    void Rename(CacheEntry *entry, int sectorNumber);
+					// Reuse an entry for another sector
+    void Forget(CacheEntry *entry);	// Make an entry hold no sector
+    void Detach(CacheEntry *entry);	// Take entry out of the LRU list
+    void MakeRecent(CacheEntry *entry);	// Move entry to the front
+
+    void Transfer(int sectorNumber, char* data, bool writing);
+					// Uncached read/write
+    void TransferAll(int count, int *sectors, char **data, bool writing);
+					// Several of them, waiting for all
+    void StartRequest(CacheEntry *entry, bool writing,
+						bool background = false);
+					// Queue a request for the disk
+    void StartNext();			// Send the next request to the disk
+    bool ServeBefore(CacheEntry *a, CacheEntry *b);
+					// C-LOOK order of two requests
+    void WaitFor(CacheEntry *entry);	// Wait until entry is not busy
 };
 
 #endif // SYNCHDISK_H
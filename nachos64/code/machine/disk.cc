@@ -20,10 +20,20 @@
 // We put this at the front of the UNIX file representing the
 // disk, to make it less likely we will accidentally treat a useful file 
 // as a disk (which would probably trash the file's contents).
+// GeometryMagic is followed by the sector size, the number of sectors
+// per track and the number of tracks; MagicNumber, by sector 0 of a
+// disk of the default geometry, as written by earlier versions.
 #define MagicNumber 	0x456789ab
-#define MagicSize 	sizeof(int)
+#define GeometryMagic 	0x456789ac
+#define MagicSize 	((int) sizeof(int))
+#define HeaderSize 	(4 * MagicSize)
 
-#define DiskSize 	(MagicSize + (NumSectors * SectorSize))
+#define DiskSize 	(headerSize + (NumSectors * SectorSize))
+
+int SectorSize = DefaultSectorSize;
+int SectorsPerTrack = DefaultSectorsPerTrack;
+int NumTracks = DefaultNumTracks;
+int NumSectors = DefaultSectorsPerTrack * DefaultNumTracks;
 
 // dummy procedure because we can't take a pointer of a member function
 static void DiskDone(void* arg) { ((Disk *)arg)->HandleInterrupt(); }
@@ -32,17 +42,21 @@ static void DiskDone(void* arg) { ((Disk *)arg)->HandleInterrupt(); }
 // Disk::Disk()
 // 	Initialize a simulated disk.  Open the UNIX file (creating it
 //	if it doesn't exist), and check the magic number to make sure it's 
-// 	ok to treat it as Nachos disk storage.
+// 	ok to treat it as Nachos disk storage.  The geometry of the disk
+//	is read from the file, or, for a new file, written to it.
 //
 //	"name" -- text name of the file simulating the Nachos disk
 //	"callWhenDone" -- interrupt handler to be called when disk read/write
 //	   request completes
 //	"callArg" -- argument to pass the interrupt handler
+//	"mapFile" -- should the file be mapped into memory, rather than
+//	   read and written a sector at a time?
 //----------------------------------------------------------------------
 
-Disk::Disk(const char* name, VoidFunctionPtr callWhenDone, void* callArg)
+Disk::Disk(const char* name, VoidFunctionPtr callWhenDone, void* callArg,
+							bool mapFile)
 {
-    int magicNum;
+    int header[HeaderSize / MagicSize];
     int tmp = 0;
 
     DEBUG('d', "Initializing the disk, 0x%x 0x%x\n", callWhenDone, callArg);
@@ -53,20 +67,59 @@ Disk::Disk(const char* name, VoidFunctionPtr callWhenDone, void* callArg)
     
     fileno = OpenForReadWrite(name, false);
     if (fileno >= 0) {		 	// file exists, check magic number 
-	Read(fileno, (char *) &magicNum, MagicSize);
-	ASSERT(magicNum == MagicNumber);
+	Read(fileno, (char *) header, MagicSize);
+	if (header[0] == GeometryMagic) {
+	    Read(fileno, (char *) &header[1], HeaderSize - MagicSize);
+	    SectorSize = header[1];
+	    SectorsPerTrack = header[2];
+	    NumTracks = header[3];
+	    headerSize = HeaderSize;
+	} else {
+	    ASSERT(header[0] == MagicNumber);
+	    SectorSize = DefaultSectorSize;
+	    SectorsPerTrack = DefaultSectorsPerTrack;
+	    NumTracks = DefaultNumTracks;
+	    headerSize = MagicSize;
+	}
+	NumSectors = SectorsPerTrack * NumTracks;
+	CheckGeometry();
     } else {				// file doesn't exist, create it
+	NumSectors = SectorsPerTrack * NumTracks;
+	CheckGeometry();
         fileno = OpenForWrite(name);
-	magicNum = MagicNumber;  
-	WriteFile(fileno, (char *) &magicNum, MagicSize); // write magic number
+	header[0] = GeometryMagic;
+	header[1] = SectorSize;
+	header[2] = SectorsPerTrack;
+	header[3] = NumTracks;
+	headerSize = HeaderSize;
+	WriteFile(fileno, (char *) header, HeaderSize); // and geometry
 
 	// need to write at end of file, so that reads will not return EOF
         Lseek(fileno, DiskSize - sizeof(int), 0);	
 	WriteFile(fileno, (char *)&tmp, sizeof(int));  
     }
+    DEBUG('d', "Disk of %d tracks of %d sectors of %d bytes\n", NumTracks,
+						SectorsPerTrack, SectorSize);
+    mapped = mapFile ? MapFile(fileno, DiskSize) : NULL;
     active = false;
 }
 
+//----------------------------------------------------------------------
+// Disk::CheckGeometry()
+// 	Make sure the geometry of the disk is one we can simulate: the
+//	sector size a power of two in range, and the whole disk small
+//	enough for its offsets in the UNIX file to fit in an int.
+//----------------------------------------------------------------------
+
+void
+Disk::CheckGeometry()
+{
+    ASSERT(SectorSize >= MinSectorSize && SectorSize <= MaxSectorSize
+			&& (SectorSize & (SectorSize - 1)) == 0);
+    ASSERT(SectorsPerTrack > 0 && NumTracks > 0);
+    ASSERT((long long) NumSectors * SectorSize + HeaderSize <= 0x7fffffff);
+}
+
 //----------------------------------------------------------------------
 // Disk::~Disk()
 // 	Clean up disk simulation, by closing the UNIX file representing the
@@ -75,9 +128,27 @@ Disk::Disk(const char* name, VoidFunctionPtr callWhenDone, void* callArg)
 
 Disk::~Disk()
 {
+    if (mapped != NULL) {
+	Sync();
+	UnmapFile(mapped, DiskSize);
+    }
     Close(fileno);
 }
 
+//----------------------------------------------------------------------
+// Disk::Sync()
+// 	If the UNIX file is mapped into memory, write the sectors that
+//	were changed in memory back to it, and wait until they are there.
+//	Otherwise every request has already gone to the file.
+//----------------------------------------------------------------------
+
+void
+Disk::Sync()
+{
+    if (mapped != NULL)
+	SyncMappedFile(mapped, DiskSize);
+}
+
 //----------------------------------------------------------------------
 // Disk::PrintSector()
 // 	Dump the data in a disk read/write request, for debugging.
@@ -121,8 +192,13 @@ Disk::ReadRequest(int sectorNumber, char* data)
     ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
     
     DEBUG('d', "Reading from sector %d\n", sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    Read(fileno, data, SectorSize);
+    if (mapped != NULL)
+	bcopy(mapped + SectorSize * sectorNumber + headerSize, data,
+								SectorSize);
+    else {
+	Lseek(fileno, SectorSize * sectorNumber + headerSize, 0);
+	Read(fileno, data, SectorSize);
+    }
     if (DebugIsEnabled('d'))
 	PrintSector(false, sectorNumber, data);
     
@@ -141,8 +217,13 @@ Disk::WriteRequest(int sectorNumber, const char* data)
     ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
     
     DEBUG('d', "Writing to sector %d\n", sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    WriteFile(fileno, data, SectorSize);
+    if (mapped != NULL)
+	bcopy(data, mapped + SectorSize * sectorNumber + headerSize,
+								SectorSize);
+    else {
+	Lseek(fileno, SectorSize * sectorNumber + headerSize, 0);
+	WriteFile(fileno, data, SectorSize);
+    }
     if (DebugIsEnabled('d'))
 	PrintSector(true, sectorNumber, data);
     
@@ -264,8 +345,11 @@ Disk::UpdateLast(int newSector)
     int rotate;
     int seek = TimeToSeek(newSector, &rotate);
     
-    if (seek != 0)
+    if (seek != 0) {
 	bufferInit = stats->totalTicks + seek + rotate;
+	stats->numDiskSeeks++;
+	stats->numSeekTracks += seek / SeekTime;
+    }
     lastSector = newSector;
     DEBUG('d', "Updating last sector = %d, %d\n", lastSector, bufferInit);
 }
@@ -45,19 +45,39 @@
 // disks these days now come with a track buffer.
 //
 // The track buffer simulation can be disabled by compiling with -DNOTRACKBUF
+//
+// The geometry of the disk is not fixed: it is recorded in the UNIX file,
+// after the magic number, and read when the disk is opened.  A new disk
+// gets the geometry set beforehand (by the -geom flag), or else the
+// default one.  Sectors are a power of two bytes, from MinSectorSize to
+// MaxSectorSize; structures that have to fit in a sector are laid out
+// for MinSectorSize, and on bigger sectors take up the start of one.
+//
+// The UNIX file can also be mapped into memory, so that transferring a
+// sector takes no system calls; then what is written reaches the file
+// for sure only once Sync is called (as the disk is flushed, and when
+// the machine halts).
 
-const int SectorSize = 128;	// number of bytes per disk sector
-const int SectorsPerTrack = 32;	// number of sectors per disk track 
-const int NumTracks = 32;	// number of tracks per disk
-const int NumSectors = SectorsPerTrack * NumTracks;
-					// total # of sectors per disk
+#define DefaultSectorSize	128
+#define DefaultSectorsPerTrack	32
+#define DefaultNumTracks	32
+#define MinSectorSize		128
+#define MaxSectorSize		65536
+
+extern int SectorSize;		// number of bytes per disk sector
+extern int SectorsPerTrack;	// number of sectors per disk track 
+extern int NumTracks;		// number of tracks per disk
+extern int NumSectors;		// total # of sectors per disk
 
 class Disk {
   public:
-    Disk(const char* name, VoidFunctionPtr callWhenDone, void* callArg);
+    Disk(const char* name, VoidFunctionPtr callWhenDone, void* callArg,
+						bool mapFile = false);
     					// Create a simulated disk.  
 					// Invoke (*callWhenDone)(callArg) 
 					// every time a request completes.
+					// If "mapFile", map the UNIX file
+					// into memory.
     ~Disk();				// Deallocate the disk.
     
     void ReadRequest(int sectorNumber, char* data);
@@ -70,6 +90,9 @@ class Disk {
     void HandleInterrupt();		// Interrupt handler, invoked when
 					// disk request finishes.
 
+    void Sync();			// Make sure what was written is in
+					// the UNIX file, if it is mapped
+
     int ComputeLatency(int newSector, bool writing);	
     					// Return how long a request to 
 					// newSector will take: 
@@ -77,6 +100,9 @@ class Disk {
 
   private:
     int fileno;				// UNIX file number for simulated disk 
+    int headerSize;			// Bytes before sector 0 in the file
+    char *mapped;			// The file, mapped into memory, or
+					// NULL if it is read and written
     VoidFunctionPtr handler;		// Interrupt handler, to be invoked 
 					// when any disk request finishes
     void* handlerArg;			// Argument to interrupt handler 
@@ -85,6 +111,7 @@ class Disk {
     int bufferInit;			// When the track buffer started 
 					// being loaded
 
+    void CheckGeometry();		// Is the geometry one we can simulate?
     int TimeToSeek(int newSector, int *rotate); // time to get to the new track
     int ModuloDiff(int to, int from);        // # sectors between to and from
     void UpdateLast(int newSector);
@@ -241,6 +241,12 @@ void
 Interrupt::Halt()
 {
     printf("Machine halting!\n\n");
+#ifdef FILESYS
+    if (synchDisk != NULL)
+	synchDisk->Shutdown();	// write back the disk buffer cache
+    if (fileSystem != NULL)
+	fileSystem->Shutdown();	// flush open files, mark the disk clean
+#endif
     stats->Print();
     Cleanup();     // Never returns.
 }
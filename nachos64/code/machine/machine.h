@@ -28,9 +28,9 @@
 
 // Definitions related to the size, and format of user memory
 
-const int PageSize = SectorSize; 	// set the page size equal to
-					// the disk sector size, for
-					// simplicity
+const int PageSize = DefaultSectorSize; 	// set the page size equal to
+					// the (default) disk sector size,
+					// for simplicity
 
 const int NumPhysPages = 32;
 const int MemorySize = NumPhysPages * PageSize;
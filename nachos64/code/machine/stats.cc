@@ -20,6 +20,10 @@ Statistics::Statistics()
 {
     totalTicks = idleTicks = systemTicks = userTicks = 0;
     numDiskReads = numDiskWrites = 0;
+    numCacheHits = numCacheMisses = 0;
+    numDiskSeeks = numSeekTracks = 0;
+    diskPolicy = NULL;
+    numJournalRecords = numCheckpoints = 0;
     numConsoleCharsRead = numConsoleCharsWritten = 0;
     numPageFaults = numPacketsSent = numPacketsRecvd = 0;
 }
@@ -36,6 +40,13 @@ Statistics::Print()
     printf("Ticks: total %d, idle %d, system %d, user %d\n", totalTicks, 
 	idleTicks, systemTicks, userTicks);
     printf("Disk I/O: reads %d, writes %d\n", numDiskReads, numDiskWrites);
+    printf("Disk cache: hits %d, misses %d\n", numCacheHits, numCacheMisses);
+    printf("Disk seeks: %d, tracks crossed %d", numDiskSeeks, numSeekTracks);
+    if (diskPolicy != NULL)
+	printf(", %s scheduling", diskPolicy);
+    printf("\n");
+    printf("Journal: records %d, checkpoints %d\n", numJournalRecords,
+	numCheckpoints);
     printf("Console I/O: reads %d, writes %d\n", numConsoleCharsRead, 
 	numConsoleCharsWritten);
     printf("Paging: faults %d\n", numPageFaults);
@@ -30,6 +30,16 @@ class Statistics {
 
     int numDiskReads;		// number of disk read requests
     int numDiskWrites;		// number of disk write requests
+    int numCacheHits;		// number of sector reads served by the
+				// buffer cache
+    int numCacheMisses;		// number of sector reads that went to disk
+    int numDiskSeeks;		// number of disk requests that had to
+				// move the disk head to another track
+    int numSeekTracks;		// total number of tracks crossed by seeks
+    const char *diskPolicy;	// disk scheduling policy, if any
+    int numJournalRecords;	// number of records written to the journal
+    int numCheckpoints;		// number of times the journal was
+				// checkpointed
     int numConsoleCharsRead;	// number of characters read from the keyboard
     int numConsoleCharsWritten; // number of characters written to the display
     int numPageFaults;		// number of virtual memory page faults
@@ -221,6 +221,48 @@ Unlink(const char *name)
     return unlink(name);
 }
 
+//----------------------------------------------------------------------
+// MapFile
+// 	Map the first "nBytes" of an open file into memory, shared, so
+//	that changes to the memory are changes to the file.  Return the
+//	address of the mapping.  Abort on error.
+//----------------------------------------------------------------------
+
+char *
+MapFile(int fd, int nBytes)
+{
+    void *address = mmap(NULL, nBytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+								fd, 0);
+
+    ASSERT(address != MAP_FAILED);
+    return (char *) address;
+}
+
+//----------------------------------------------------------------------
+// SyncMappedFile
+// 	Write the changes to a mapped file back to the file, and wait
+//	until they are there.  Abort on error.
+//----------------------------------------------------------------------
+
+void
+SyncMappedFile(char *address, int nBytes)
+{
+    int retVal = msync(address, nBytes, MS_SYNC);
+    ASSERT(retVal == 0);
+}
+
+//----------------------------------------------------------------------
+// UnmapFile
+// 	Undo MapFile.  Abort on error.
+//----------------------------------------------------------------------
+
+void
+UnmapFile(char *address, int nBytes)
+{
+    int retVal = munmap(address, nBytes);
+    ASSERT(retVal == 0);
+}
+
 //----------------------------------------------------------------------
 // OpenSocket
 // 	Open an interprocess communication (IPC) connection.  For now, 
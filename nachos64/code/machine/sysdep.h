@@ -29,6 +29,12 @@ extern int Tell(int fd);
 extern void Close(int fd);
 extern bool Unlink(const char *name);
 
+// Mapping an open file into memory, so that it can be read and written
+// without system calls; changes reach the file when they are synced
+extern char *MapFile(int fd, int nBytes);
+extern void SyncMappedFile(char *address, int nBytes);
+extern void UnmapFile(char *address, int nBytes);
+
 // Interprocess communication operations, for simulating the network
 extern int OpenSocket();
 extern void CloseSocket(int sockID);
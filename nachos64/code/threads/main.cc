@@ -10,8 +10,11 @@
 //
 // Usage: nachos -d <debugflags> -rs <random seed #>
 //		-s -x <nachos file> -c <consoleIn> <consoleOut>
-//		-f -cp <unix file> <nachos file>
-//		-p <nachos file> -r <nachos file> -l -D -t
+//		-f -cache <# sectors> -ds <fifo|clook|deadline> -da -dn
+//		-geom <sector size> <sectors per track> <# tracks> -mmap
+//		-cp <unix file> <nachos file>
+//		-p <nachos file> -r <nachos file> -l -D -t -tm -ts
+//		-mkdir <nachos directory> -rmdir <nachos directory>
 //              -n <network reliability> -m <machine id>
 //              -o <other machine id>
 //              -z
@@ -27,12 +30,27 @@
 //
 //  FILESYS
 //    -f causes the physical disk to be formatted
+//    -cache sets the number of sectors in the disk buffer cache
+//	(0 turns the cache off)
+//    -ds sets the order in which disk requests are served
+//    -da delays choosing the disk sectors for data appended to a file
+//	until the data is flushed
+//    -dn keeps new directories near their parent, rather than
+//	spreading them over the groups of tracks of the disk
+//    -geom, along with -f, makes a new disk with the given geometry
+//	(otherwise the disk keeps the geometry it was made with)
+//    -mmap maps the DISK file into memory, instead of reading and
+//	writing it a sector at a time
 //    -cp copies a file from UNIX to Nachos
 //    -p prints a Nachos file to stdout
 //    -r removes a Nachos file from the file system
+//    -mkdir creates a Nachos directory
+//    -rmdir removes an empty Nachos directory
 //    -l lists the contents of the Nachos directory
 //    -D prints the contents of the entire file system 
 //    -t tests the performance of the Nachos file system
+//    -tm measures the disk seeks made using many small files
+//    -ts checks that two opens of a file see each other's writes
 //
 //  NETWORK
 //    -n sets the network reliability
@@ -60,6 +78,8 @@ void ThreadTest();
 void Copy(const char *unixFile, const char *nachosFile);
 void Print(const char *file);
 void PerformanceTest(void);
+void ManyFilesTest(void);
+void SharedFileTest(void);
 void StartProcess(const char *file);
 void ConsoleTest(const char *in, const char *out);
 void MailTest(int networkID);
@@ -126,12 +146,24 @@ main(int argc, char **argv)
 	    ASSERT(argc > 1);
 	    fileSystem->Remove(*(argv + 1));
 	    argCount = 2;
+	} else if (!strcmp(*argv, "-mkdir")) {	// create Nachos directory
+	    ASSERT(argc > 1);
+	    fileSystem->CreateDirectory(*(argv + 1));
+	    argCount = 2;
+	} else if (!strcmp(*argv, "-rmdir")) {	// remove Nachos directory
+	    ASSERT(argc > 1);
+	    fileSystem->RemoveDirectory(*(argv + 1));
+	    argCount = 2;
 	} else if (!strcmp(*argv, "-l")) {	// list Nachos directory
             fileSystem->List();
 	} else if (!strcmp(*argv, "-D")) {	// print entire filesystem
             fileSystem->Print();
 	} else if (!strcmp(*argv, "-t")) {	// performance test
             PerformanceTest();
+	} else if (!strcmp(*argv, "-tm")) {	// many files test
+            ManyFilesTest();
+	} else if (!strcmp(*argv, "-ts")) {	// shared file test
+            SharedFileTest();
 	}
 #endif // FILESYS
 #ifdef NETWORK
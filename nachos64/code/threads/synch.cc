@@ -217,3 +217,94 @@ void Condition::Broadcast( Lock * conditionLock ) {
 
 }
 
+
+//----------------------------------------------------------------------
+// RWLock::RWLock
+// 	Initialize a readers/writers lock, so that it can be used for
+//	synchronization.  Nobody holds it yet.
+//
+//	"debugName" is an arbitrary name, useful for debugging.
+//----------------------------------------------------------------------
+
+RWLock::RWLock(const char* debugName)
+{
+    name = (char *) debugName;
+    lock = new Lock(debugName);
+    okToRead = new Condition(debugName);
+    okToWrite = new Condition(debugName);
+    readers = 0;
+    waitingWriters = 0;
+    writer = NULL;
+}
+
+//----------------------------------------------------------------------
+// RWLock::~RWLock
+// 	De-allocate a readers/writers lock, when no one holds it.
+//----------------------------------------------------------------------
+
+RWLock::~RWLock()
+{
+    ASSERT(readers == 0 && writer == NULL);
+    delete okToRead;
+    delete okToWrite;
+    delete lock;
+}
+
+//----------------------------------------------------------------------
+// RWLock::AcquireRead/ReleaseRead
+// 	Wait until no thread is writing, or waiting to write, then become
+//	one more reader; and stop being one.  The last reader to leave
+//	lets a waiting writer in.
+//----------------------------------------------------------------------
+
+void
+RWLock::AcquireRead()
+{
+    lock->Acquire();
+    while (writer != NULL || waitingWriters > 0)
+	okToRead->Wait(lock);
+    readers++;
+    lock->Release();
+}
+
+void
+RWLock::ReleaseRead()
+{
+    lock->Acquire();
+    ASSERT(readers > 0);
+    if (--readers == 0)
+	okToWrite->Signal(lock);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// RWLock::AcquireWrite/ReleaseWrite
+// 	Wait until no thread holds the lock, then take it for writing;
+//	and give it up, letting in the next writer if there is one, or
+//	else every reader that is waiting.
+//----------------------------------------------------------------------
+
+void
+RWLock::AcquireWrite()
+{
+    lock->Acquire();
+    waitingWriters++;
+    while (writer != NULL || readers > 0)
+	okToWrite->Wait(lock);
+    waitingWriters--;
+    writer = currentThread;
+    lock->Release();
+}
+
+void
+RWLock::ReleaseWrite()
+{
+    lock->Acquire();
+    ASSERT(writer == currentThread);
+    writer = NULL;
+    if (waitingWriters > 0)
+	okToWrite->Signal(lock);
+    else
+	okToRead->Broadcast(lock);
+    lock->Release();
+}
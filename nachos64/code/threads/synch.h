@@ -2,7 +2,8 @@
 //	Data structures for synchronizing threads.
 //
 //	Three kinds of synchronization are defined here: semaphores,
-//	locks, and condition variables.  The implementation for
+//	locks, and condition variables; readers/writers locks are
+//	built out of the last two.  The implementation for
 //	semaphores is given; for the latter two, only the procedure
 //	interface is given -- they are to be implemented as part of 
 //	the first assignment.
@@ -138,5 +139,40 @@ class Condition {
     // plus some other stuff you'll need to define
     List<Semaphore *> *waitQueue;
 };
+
+// The following class defines a "readers/writers lock".  Any number of
+// threads may hold it for reading at the same time, but a thread that
+// holds it for writing holds it alone:
+//
+//	AcquireRead/ReleaseRead -- share the lock with other readers
+//
+//	AcquireWrite/ReleaseWrite -- have the lock to yourself
+//
+// Once a writer is waiting, new readers wait behind it, so that a
+// steady stream of readers cannot keep writers out forever.  As with
+// locks, only the thread that acquired the lock may release it, and a
+// thread must not acquire a lock it already holds.
+
+class RWLock {
+  public:
+    RWLock(const char* debugName);	// initialize lock to be FREE
+    ~RWLock();				// deallocate lock
+    char* getName() { return name; }	// debugging assist
+
+    void AcquireRead();
+    void ReleaseRead();
+    void AcquireWrite();
+    void ReleaseWrite();
+
+  private:
+    char* name;				// for debugging
+    Lock *lock;				// protects the fields below
+    Condition *okToRead;		// signalled when readers may go on
+    Condition *okToWrite;		// signalled when a writer may go on
+    int readers;			// # threads holding it for reading
+    int waitingWriters;			// # threads waiting to write
+    Thread *writer;			// thread holding it for writing,
+					// or NULL
+};
 #endif // SYNCH_H
 
@@ -30,7 +30,6 @@ FileSystem  *fileSystem;
 
 #ifdef FILESYS
 SynchDisk   *synchDisk;
-Lock *fileLock;
 #endif
 
 #ifdef USER_PROGRAM	// requires either FILESYS or FILESYS_STUB
@@ -99,6 +98,14 @@ Initialize(int argc, char **argv)
 #endif
 #ifdef FILESYS_NEEDED
     bool format = false;	// format disk
+    bool delayAllocation = false;	// allocate appended data at flush
+    bool spreadDirectories = true;	// spread directories over the disk
+#endif
+#ifdef FILESYS
+    int cacheSize = DefaultCacheSize;	// sectors in the disk buffer cache
+    DiskPolicy diskPolicy = CLookPolicy;	// disk scheduling policy
+    bool newGeometry = false;		// format with a geometry of our own
+    bool mapDisk = false;		// map the DISK file into memory
 #endif
 #ifdef NETWORK
     double rely = 1;		// network reliability
@@ -139,6 +146,38 @@ Initialize(int argc, char **argv)
 	if (!strcmp(*argv, "-f"))
 	    format = true;
 #endif
+#ifdef FILESYS
+	if (!strcmp(*argv, "-cache")) {
+	    ASSERT(argc > 1);
+	    cacheSize = atoi(*(argv + 1));
+	    argCount = 2;
+	} else if (!strcmp(*argv, "-ds")) {
+	    ASSERT(argc > 1);
+	    if (!strcmp(*(argv + 1), "fifo"))
+		diskPolicy = FifoPolicy;
+	    else if (!strcmp(*(argv + 1), "clook"))
+		diskPolicy = CLookPolicy;
+	    else if (!strcmp(*(argv + 1), "deadline"))
+		diskPolicy = DeadlinePolicy;
+	    else
+		ASSERT(false);		// unknown policy
+	    argCount = 2;
+	} else if (!strcmp(*argv, "-da"))
+	    delayAllocation = true;
+	else if (!strcmp(*argv, "-dn"))
+	    spreadDirectories = false;
+	else if (!strcmp(*argv, "-mmap"))
+	    mapDisk = true;
+	else if (!strcmp(*argv, "-geom")) {
+	    ASSERT(argc > 3);
+	    SectorSize = atoi(*(argv + 1));
+	    SectorsPerTrack = atoi(*(argv + 2));
+	    NumTracks = atoi(*(argv + 3));
+	    NumSectors = SectorsPerTrack * NumTracks;
+	    newGeometry = true;
+	    argCount = 4;
+	}
+#endif
 #ifdef NETWORK
 	if (!strcmp(*argv, "-l")) {
 	    ASSERT(argc > 1);
@@ -182,12 +221,14 @@ Initialize(int argc, char **argv)
 #endif
 
 #ifdef FILESYS
-    synchDisk = new SynchDisk("DISK");
-    fileLock = new Lock("FILELOCK");
+    if (newGeometry && format)		// the geometry of an existing disk
+	Unlink("DISK");			// is that in its header
+    synchDisk = new SynchDisk("DISK", cacheSize, diskPolicy, mapDisk);
 #endif
 
 #ifdef FILESYS_NEEDED
-    fileSystem = new FileSystem(format);
+    fileSystem = new FileSystem(format, delayAllocation,
+				spreadDirectories);
 #endif
 
 #ifdef NETWORK
@@ -43,7 +43,6 @@ extern FileSystem  *fileSystem;
 #include "synchdisk.h"
 #include "synch.h"
 extern SynchDisk   *synchDisk;
-extern Lock *fileLock;
 #endif
 
 #ifdef NETWORK
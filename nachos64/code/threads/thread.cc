@@ -41,6 +41,9 @@ Thread::Thread(const char* threadName)
 #ifdef USER_PROGRAM
     space = NULL;
 #endif
+#ifdef FILESYS
+    bounceBuffer = NULL;
+#endif
 }
 
 //----------------------------------------------------------------------
@@ -62,6 +65,9 @@ Thread::~Thread()
     ASSERT(this != currentThread);
     if (stack != NULL)
 	DeallocBoundedArray((char *) stack, StackSize * sizeof(HostMemoryAddress));
+#ifdef FILESYS
+    delete [] bounceBuffer;
+#endif
 }
 
 //----------------------------------------------------------------------
@@ -310,3 +316,19 @@ Thread::RestoreUserState()
 	machine->WriteRegister(i, userRegisters[i]);
 }
 #endif
+
+#ifdef FILESYS
+//----------------------------------------------------------------------
+// Thread::BounceBuffer
+//	Return this thread's buffer for partial sector transfers,
+//	allocating it the first time it is needed.
+//----------------------------------------------------------------------
+
+char *
+Thread::BounceBuffer()
+{
+    if (bounceBuffer == NULL)
+	bounceBuffer = new char[SectorSize];
+    return bounceBuffer;
+}
+#endif
@@ -125,6 +125,19 @@ class Thread {
 
     AddrSpace *space;			// User code this thread is running.
 #endif
+
+#ifdef FILESYS
+// To read or write part of a disk sector, a thread needs a buffer to
+// hold the whole sector.  Each thread keeps one, so that it can be
+// reused from one transfer to the next, even while other threads,
+// with buffers of their own, wait for the disk.
+
+  public:
+    char *BounceBuffer();		// A sector's worth of memory, for
+					// use by this thread only
+  private:
+    char *bounceBuffer;			// NULL until first needed
+#endif
 };
 
 // Magical machine-dependent routines, defined in switch.s
@@ -15,15 +15,29 @@
 //	it can be added somewhere on a list.
 //
 //	"nitems" is the number of bits in the bitmap.
+//	"regionBits" is the number of bits in each region whose clear
+//	bits are counted separately (for instance, to know how full each
+//	part of the disk is), or 0 for a single region.
 //----------------------------------------------------------------------
 
-BitMap::BitMap(int nitems) 
+BitMap::BitMap(int nitems, int regionBits) 
 { 
     numBits = nitems;
     numWords = divRoundUp(numBits, BitsInWord);
     map = new unsigned int[numWords];
-    for (int i = 0; i < numBits; i++) 
-        Clear(i);
+    bzero(map, numWords * sizeof(unsigned int));
+    numClear = numBits;
+    regionSize = (regionBits > 0) ? regionBits : numBits;
+    numRegions = divRoundUp(numBits, regionSize);
+    regionClear = new int[numRegions];
+    for (int i = 0; i < numRegions; i++)
+	regionClear[i] = (i < numRegions - 1) ? regionSize
+					: numBits - i * regionSize;
+    cursor = 0;
+    numPieces = divRoundUp(numBits, BitsInPiece);
+    dirty = new bool[numPieces];
+    for (int i = 0; i < numPieces; i++)
+	dirty[i] = true;		// never written back
 }
 
 //----------------------------------------------------------------------
@@ -34,6 +48,8 @@ BitMap::BitMap(int nitems)
 BitMap::~BitMap()
 { 
     delete map;
+    delete [] regionClear;
+    delete [] dirty;
 }
 
 //----------------------------------------------------------------------
@@ -47,7 +63,12 @@ void
 BitMap::Mark(int which) 
 { 
     ASSERT(which >= 0 && which < numBits);
-    map[which / BitsInWord] |= 1 << (which % BitsInWord);
+    if (!Test(which)) {
+	numClear--;
+	regionClear[which / regionSize]--;
+	dirty[which / BitsInPiece] = true;
+    }
+    map[which / BitsInWord] |= 1u << (which % BitsInWord);
 }
     
 //----------------------------------------------------------------------
@@ -61,7 +82,12 @@ void
 BitMap::Clear(int which) 
 {
     ASSERT(which >= 0 && which < numBits);
-    map[which / BitsInWord] &= ~(1 << (which % BitsInWord));
+    if (Test(which)) {
+	numClear++;
+	regionClear[which / regionSize]++;
+	dirty[which / BitsInPiece] = true;
+    }
+    map[which / BitsInWord] &= ~(1u << (which % BitsInWord));
 }
 
 //----------------------------------------------------------------------
@@ -76,7 +102,7 @@ BitMap::Test(int which)
 {
     ASSERT(which >= 0 && which < numBits);
     
-    if (map[which / BitsInWord] & (1 << (which % BitsInWord)))
+    if (map[which / BitsInWord] & (1u << (which % BitsInWord)))
 	return true;
     else
 	return false;
@@ -84,22 +110,201 @@ BitMap::Test(int which)
 
 //----------------------------------------------------------------------
 // BitMap::Find
-// 	Return the number of the first bit which is clear.
+// 	Return the number of a bit which is clear.
 //	As a side effect, set the bit (mark it as in use).
 //	(In other words, find and allocate a bit.)
 //
+//	If there is a clear bit in the region of bit "goal", the first
+//	one after "goal" (wrapping around to the start of the region) is
+//	chosen, so that related things end up close together.  Otherwise
+//	the search is next-fit: it starts where the previous one left
+//	off, wrapping around at the end of the map, so repeated calls
+//	do not rescan the bits they have already handed out.
+//
 //	If no bits are clear, return -1.
+//
+//	"goal" is the preferred bit, or -1 if there is none
 //----------------------------------------------------------------------
 
 int 
-BitMap::Find() 
+BitMap::Find(int goal) 
 {
-    for (int i = 0; i < numBits; i++)
-	if (!Test(i)) {
-	    Mark(i);
-	    return i;
+    int which, start, end;
+
+    if (numClear == 0)
+	return -1;
+    if (goal >= 0 && goal < numBits
+			&& regionClear[goal / regionSize] > 0) {
+	start = goal / regionSize * regionSize;
+	end = (start + regionSize < numBits) ? start + regionSize : numBits;
+	which = NextClearIn(goal, end);
+	if (which == -1)
+	    which = NextClearIn(start, goal);
+	ASSERT(which != -1);
+	Mark(which);
+	return which;
+    }
+    which = NextClear(cursor);
+    if (which == numBits)
+	which = NextClear(0);
+    Mark(which);
+    cursor = (which + 1 < numBits) ? which + 1 : 0;
+    return which;
+}
+
+//----------------------------------------------------------------------
+// BitMap::NextClear/NextSet
+// 	Return the first bit at or after "from" which is clear (or set),
+//	or numBits if there is none.  Whole words are skipped at once,
+//	and the bit within a word is found by counting trailing zeros.
+//
+//	"from" is the first bit to look at
+//----------------------------------------------------------------------
+
+int
+BitMap::NextClear(int from)
+{
+    int i = from / BitsInWord;
+    unsigned int word;
+
+    if (from >= numBits)
+	return numBits;
+    word = ~map[i] & (~0u << (from % BitsInWord));
+    while (word == 0) {
+	if (++i == numWords)
+	    return numBits;
+	word = ~map[i];
+    }
+    from = i * BitsInWord + __builtin_ctz(word);
+    return (from < numBits) ? from : numBits;
+}
+
+int
+BitMap::NextSet(int from)
+{
+    int i = from / BitsInWord;
+    unsigned int word;
+
+    if (from >= numBits)
+	return numBits;
+    word = map[i] & (~0u << (from % BitsInWord));
+    while (word == 0) {
+	if (++i == numWords)
+	    return numBits;
+	word = map[i];
+    }
+    from = i * BitsInWord + __builtin_ctz(word);
+    return (from < numBits) ? from : numBits;
+}
+
+//----------------------------------------------------------------------
+// BitMap::NextClearIn
+// 	Return the first clear bit in [from, to), or -1 if there is none;
+//	unlike NextClear, the search stops at "to".
+//
+//	"from" is the first bit to look at
+//	"to" is one past the last one
+//----------------------------------------------------------------------
+
+int
+BitMap::NextClearIn(int from, int to)
+{
+    int i = from / BitsInWord;
+    int last = (to - 1) / BitsInWord;
+    unsigned int word;
+
+    if (from >= to)
+	return -1;
+    word = ~map[i] & (~0u << (from % BitsInWord));
+    while (word == 0) {
+	if (++i > last)
+	    return -1;
+	word = ~map[i];
+    }
+    from = i * BitsInWord + __builtin_ctz(word);
+    return (from < to) ? from : -1;
+}
+
+//----------------------------------------------------------------------
+// BitMap::FindRun
+// 	Find a run of consecutive clear bits, and set them.  Used to give
+//	a file several disk sectors in a row, so that reading it
+//	sequentially does not make the disk head seek back and forth.
+//
+//	If bit "goal" is clear, the run starts there (this is how a file
+//	keeps growing in place).  Otherwise the run is chosen best-fit
+//	(see BestFit) among those starting in the region of "goal", if
+//	one of them is long enough, or else among all of them.
+//
+//	Return the first bit of the run, or -1 if no bits are clear.
+//
+//	"count" is the number of bits wanted
+//	"length" is set to the number of bits actually set, at most "count"
+//	"goal" is the preferred first bit, or -1 if there is none
+//----------------------------------------------------------------------
+
+int
+BitMap::FindRun(int count, int *length, int goal)
+{
+    int best = -1, bestLength = 0;
+    int start, i;
+
+    if (goal >= 0 && goal < numBits && !Test(goal)) {
+	best = goal;
+	bestLength = NextSet(goal) - goal;
+    } else {
+	if (goal >= 0 && goal < numBits) {
+	    start = goal / regionSize * regionSize;
+	    best = BestFit(start, start + regionSize, count, &bestLength);
+	    if (bestLength < count)
+		best = -1;		// look in the whole map instead
+	}
+	if (best == -1)
+	    best = BestFit(0, numBits, count, &bestLength);
+    }
+    if (best == -1)
+	return -1;
+    if (bestLength > count)
+	bestLength = count;
+    for (i = best; i < best + bestLength; i++)
+	Mark(i);
+    *length = bestLength;
+    return best;
+}
+
+//----------------------------------------------------------------------
+// BitMap::BestFit
+// 	Return the first bit of the best run of clear bits, among those
+//	starting in [from, to): the shortest run of at least "count"
+//	clear bits, or if there is none, the longest run there is -- the
+//	caller then asks again for the rest.  Return -1 if there is no
+//	clear bit there at all.  Nothing is set.
+//
+//	"from" is the first bit a run may start at
+//	"to" is one past the last one
+//	"count" is the number of bits wanted
+//	"length" is set to the length of the run, at most "count"
+//----------------------------------------------------------------------
+
+int
+BitMap::BestFit(int from, int to, int count, int *length)
+{
+    int best = -1, bestLength = 0;
+    int start, end;
+
+    if (to > numBits)
+	to = numBits;
+    for (start = NextClear(from); start < to && bestLength != count;
+						start = NextClear(end)) {
+	end = NextSet(start);
+	if ((bestLength < count && end - start > bestLength)
+		|| (end - start >= count && end - start < bestLength)) {
+	    best = start;
+	    bestLength = end - start;
 	}
-    return -1;
+    }
+    *length = (bestLength < count) ? bestLength : count;
+    return best;
 }
 
 //----------------------------------------------------------------------
@@ -111,11 +316,77 @@ BitMap::Find()
 int 
 BitMap::NumClear() 
 {
-    int count = 0;
+    return numClear;
+}
 
-    for (int i = 0; i < numBits; i++)
-	if (!Test(i)) count++;
-    return count;
+//----------------------------------------------------------------------
+// BitMap::NumRegions/RegionClear/RegionStart
+// 	Return the number of regions, and the number of clear bits in
+//	region "region", or its first bit.
+//----------------------------------------------------------------------
+
+int
+BitMap::NumRegions()
+{
+    return numRegions;
+}
+
+int
+BitMap::RegionClear(int region)
+{
+    ASSERT(region >= 0 && region < numRegions);
+    return regionClear[region];
+}
+
+int
+BitMap::RegionStart(int region)
+{
+    ASSERT(region >= 0 && region < numRegions);
+    return region * regionSize;
+}
+
+//----------------------------------------------------------------------
+// BitMap::CountSet
+// 	Return the number of set bits in [from, to), counted a word at
+//	a time.
+//
+//	"from" is the first bit to count
+//	"to" is one past the last one
+//----------------------------------------------------------------------
+
+int
+BitMap::CountSet(int from, int to)
+{
+    int set = 0;
+
+    for (int i = from / BitsInWord; i * BitsInWord < to; i++) {
+	unsigned int word = map[i];
+
+	if (i == from / BitsInWord)		// ignore the bits outside
+	    word &= ~0u << (from % BitsInWord);
+	if ((i + 1) * BitsInWord > to)
+	    word &= (1u << (to % BitsInWord)) - 1;
+	set += __builtin_popcount(word);
+    }
+    return set;
+}
+
+//----------------------------------------------------------------------
+// BitMap::Recount
+// 	Count the clear bits from scratch; needed when the whole map has
+//	been replaced, as by FetchFrom.
+//----------------------------------------------------------------------
+
+void
+BitMap::Recount()
+{
+    numClear = 0;
+    for (int r = 0; r < numRegions; r++) {
+	int last = (r < numRegions - 1) ? (r + 1) * regionSize : numBits;
+
+	regionClear[r] = last - r * regionSize - CountSet(r * regionSize, last);
+	numClear += regionClear[r];
+    }
 }
 
 //----------------------------------------------------------------------
@@ -149,11 +420,41 @@ void
 BitMap::FetchFrom(OpenFile *file) 
 {
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    Recount();
+    cursor = 0;
+    for (int i = 0; i < numPieces; i++)
+	dirty[i] = false;
+}
+
+//----------------------------------------------------------------------
+// BitMap::FetchFrom
+// 	Initialize the contents of a bitmap from a Nachos file, along
+//	with the number of clear bits, which are known to be right (they
+//	were saved, say, when the file system was last shut down), and
+//	so need not be counted.
+//
+//	"file" is the place to read the bitmap from
+//	"clear" is the number of clear bits in the bitmap
+//	"regions" is the number of clear bits in each region
+//----------------------------------------------------------------------
+
+void
+BitMap::FetchFrom(OpenFile *file, int clear, const int *regions) 
+{
+    file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    numClear = clear;
+    for (int i = 0; i < numRegions; i++)
+	regionClear[i] = regions[i];
+    cursor = 0;
+    for (int i = 0; i < numPieces; i++)
+	dirty[i] = false;
 }
 
 //----------------------------------------------------------------------
 // BitMap::WriteBack
-// 	Store the contents of a bitmap to a Nachos file.
+// 	Store the contents of a bitmap to a Nachos file.  Only the
+//	pieces of the file whose bits have changed are written, a run
+//	of consecutive ones at a time.
 //
 //	"file" is the place to write the bitmap to
 //----------------------------------------------------------------------
@@ -161,5 +462,17 @@ BitMap::FetchFrom(OpenFile *file)
 void
 BitMap::WriteBack(OpenFile *file)
 {
-   file->WriteAt((char *)map, numWords * sizeof(unsigned), 0);
+    int size = numWords * sizeof(unsigned);
+    int position, end, first;
+
+    for (int i = 0; i < numPieces; i++)
+	if (dirty[i]) {
+	    first = i;
+	    while (i < numPieces && dirty[i])
+		dirty[i++] = false;
+	    position = first * MinSectorSize;
+	    end = i * MinSectorSize;
+	    file->WriteAt((char *)map + position,
+		((size < end) ? size : end) - position, position);
+	}
 }
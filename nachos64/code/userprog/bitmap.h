@@ -3,10 +3,14 @@
 //	can be either on or off.
 //
 //	Represented as an array of unsigned integers, on which we do
-//	modulo arithmetic to find the bit we are interested in.
+//	modulo arithmetic to find the bit we are interested in.  Searches
+//	look at a whole word at a time, and the number of clear bits is
+//	kept as the bits change, rather than counted on demand.
 //
 //	The bitmap can be parameterized with with the number of bits being 
-//	managed.
+//	managed, and with the size of the regions it is divided into; the
+//	number of clear bits in each region is kept as well, and searches
+//	can be kept to the region of a given bit.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -18,11 +22,18 @@
 #include "copyright.h"
 #include "utility.h"
 #include "openfile.h"
+#include "disk.h"
 
 // Definitions helpful for representing a bitmap as an array of integers
 #define BitsInByte 	8
 #define BitsInWord 	32
 
+// When a bitmap is stored in a file, only the pieces of it that have
+// changed are written back, each run of changed pieces at once.  A piece
+// is the smallest sector's worth of bits (the bitmap does not know the
+// sector size of the disk it is kept on).
+#define BitsInPiece	(MinSectorSize * BitsInByte)
+
 // The following class defines a "bitmap" -- an array of bits,
 // each of which can be independently set, cleared, and tested.
 //
@@ -33,24 +44,38 @@
 
 class BitMap {
   public:
-    BitMap(int nitems);		// Initialize a bitmap, with "nitems" bits
-				// initially, all bits are cleared.
+    BitMap(int nitems, int regionBits = 0);
+				// Initialize a bitmap, with "nitems" bits
+				// initially, all bits are cleared; in
+				// regions of "regionBits" (0 for one)
     ~BitMap();			// De-allocate bitmap
     
     void Mark(int which);   	// Set the "nth" bit
     void Clear(int which);  	// Clear the "nth" bit
     bool Test(int which);   	// Is the "nth" bit set?
-    int Find();            	// Return the # of a clear bit, and as a side
-				// effect, set the bit. 
-				// If no bits are clear, return -1.
+    int Find(int goal = -1);	// Return the # of a clear bit, and as a side
+				// effect, set the bit; preferably in the
+				// region of "goal", as close after it as
+				// possible.  If no bits are clear, return -1.
+    int FindRun(int count, int *length, int goal = -1);
+				// Find and set up to "count" consecutive
+				// clear bits; return the first one, and
+				// how many were set in "length"
     int NumClear();		// Return the number of clear bits
+    int NumRegions();		// Return the number of regions
+    int RegionClear(int region);	// Return the number of clear bits
+				// in "region"
+    int RegionStart(int region);	// Return the first bit of "region"
 
     void Print();		// Print contents of bitmap
     
     // These aren't needed until FILESYS, when we will need to read and 
     // write the bitmap to a file
     void FetchFrom(OpenFile *file); 	// fetch contents from disk 
-    void WriteBack(OpenFile *file); 	// write contents to disk
+    void FetchFrom(OpenFile *file, int clear, const int *regions);
+					// ...and trust these counts of
+					// clear bits, rather than counting
+    void WriteBack(OpenFile *file); 	// write changed contents to disk
 
   private:
     int numBits;			// number of bits in the bitmap
@@ -59,6 +84,28 @@ class BitMap {
 					//  multiple of the number of bits in
 					//  a word)
     unsigned int *map;			// bit storage
+    int numClear;			// number of clear bits, kept up to
+					// date by every change to "map"
+    int numRegions;			// number of regions
+    int regionSize;			// bits in each (the last may be
+					// shorter)
+    int *regionClear;			// number of clear bits in each
+    int cursor;				// where Find starts looking (next-fit)
+    bool *dirty;			// which BitsInPiece pieces of the
+					// map have changed since they were
+					// last fetched or written back
+    int numPieces;			// number of entries in "dirty"
+
+    int NextClear(int from);		// First clear/set bit at or after
+    int NextSet(int from);		// "from", or numBits if none
+    int NextClearIn(int from, int to);	// First clear bit in [from, to),
+					// or -1 if none
+    int BestFit(int from, int to, int count, int *length);
+					// Best run of clear bits for "count"
+					// starting in [from, to)
+    int CountSet(int from, int to);	// Number of set bits in [from, to)
+    void Recount();			// Recompute numClear and regionClear
+					// from "map"
 };
 
 #endif // BITMAP_H